@@ -94,6 +94,9 @@
 #include <math.h>
 #include <stdlib.h>
 #include "xuartps.h" //replace xuart_lite.h
+#ifdef XPAR_TMRCTR_0_DEVICE_ID
+#include "xtmrctr.h" //free running timer for mailbox timestamps
+#endif
 
 
 /************************** Constant Definitions ****************************/
@@ -117,10 +120,29 @@
 #define GAME_LOSE 2
 #define GAME_PAUSE 3
 #define GAME_RESET 4
+#define GAME_BALLHELD 5
+#define GAME_READY 6	// control message only, ball has reset and waits for GAME_NORMAL
 
-//message for
-#define MESSAGE_FOR_BALL 0
-#define MESSAGE_FOR_GAME 1
+//msgqueue addresses
+#define CHANNEL_Q	23	// CHANNEL_Q + channel, one msgqueue per mailbox channel
+
+//message type
+#define MSG_TYPE_BALL 1			// ball position and collisions, ball -> game
+#define MSG_TYPE_GAME 2			// bar, score and powerups, game -> ball
+#define MSG_TYPE_CONTROL 3		// game state changes (pause, resume, ballheld, win, reset)
+#define MSG_TYPE_EVENT 4		// one-off notifications that are not part of a frame
+
+//mailbox channels, lower number is taken first by mbox_wait
+#define CHANNEL_CONTROL 0
+#define CHANNEL_EVENT 1
+#define CHANNEL_STATE 2
+#define NUM_CHANNELS 3
+
+//events
+#define EVENT_DUMPSTATS 1		// ask the other side to print its mailbox stats
+
+//mailbox stats
+#define HIST_BUCKETS 20			// bucket i counts samples in [2^i, 2^(i+1)) us, last bucket takes the rest
 
 //bar
 #define BAR_TOP 405
@@ -152,6 +174,15 @@
 #define RIGHT_HIT 23
 #define BAR_HIT 24
 
+//paddle word, published by game in a hw mutex user register and read by ball at every physics step
+#define PADDLE_VALID 0x80000000	// clear until game has published once
+#define PADDLE_WORD(pos, seq) (PADDLE_VALID | (((seq) & 0xff) << 10) | ((pos) & 0x3ff))
+#define PADDLE_POS(word) ((word) & 0x3ff)
+#define PADDLE_SEQ(word) (((word) >> 10) & 0xff)
+#ifndef PADDLE_DIRECT
+#define PADDLE_DIRECT 1			// 0 takes the bar position from msg_game only, a frame later
+#endif
+
 
 /**
 * User has to specify a 2MB memory space for filling the frame data.
@@ -163,8 +194,18 @@
 /**************************** Type Definitions ******************************/
 
 
+// common header in front of every mailbox message
 typedef struct {
-	int message_for;
+	int type;					// MSG_TYPE_*
+	int channel;				// CHANNEL_*, the msgqueue the dispatcher delivers it to
+	int size;					// whole message in bytes, header included
+	unsigned int seq;			// sequence number, per sender
+	unsigned int timestamp;		// timestamp() at send
+	unsigned int echo;			// timestamp of the last message received from the other side, 0 if none
+} msg_header;
+
+typedef struct {
+	msg_header header;
 	int ballx;
 	int bally;
 	int brickrow;
@@ -173,28 +214,69 @@ typedef struct {
 } msg_ball;
 
 typedef struct {
-	int message_for;
+	msg_header header;
 	int bar_position;
 	int score;
-	int game_status;
 	int poweruphold;
 	int poweruplengthen;
 	int ballheldx;
+	unsigned int bar_time;		// timestamp() of the input that put the bar at bar_position
 } msg_game;	//debug - try removing the dummy data if mailbox is always in order
 
+typedef struct {
+	msg_header header;
+	int game_status;
+} msg_control;
+
+typedef struct {
+	msg_header header;
+	int event;					// EVENT_*
+	int arg;
+} msg_event;
+
+// large enough for any message, what the dispatcher reads into and queues
+typedef union {
+	msg_header header;
+	msg_ball ball;
+	msg_game game;
+	msg_control control;
+	msg_event event;
+} msg_any;
+
+typedef struct {
+	unsigned int count;
+	unsigned int min;
+	unsigned int max;
+	unsigned long long sum;
+	unsigned int bucket[HIST_BUCKETS];
+} latency_hist;
+
+typedef struct {
+	unsigned int sent;
+	unsigned int received;
+	unsigned int expected_seq;	// next sequence number expected from the other side
+	unsigned int gaps;			// messages skipped over
+	unsigned int reordered;		// messages older than one already received
+	unsigned int misrouted;		// bad headers, each one leaves the fifo out of step until mbox_receive resyncs
+	unsigned int skipped;		// words dropped while resyncing
+	unsigned int channel_received[NUM_CHANNELS];
+	unsigned int last_timestamp;	// echoed back in the next message sent
+	latency_hist oneway;		// only meaningful if both processors read the same timer
+	latency_hist roundtrip;
+} mbox_stats;
+
 /************************** Function Prototypes *****************************/
 //threads
 
 //ball
 void* thread_func_1 ();
-void* thread_reset();
+void* thread_mbox();
 
 
 //generic function declarations
 int main_prog(void);
 void init_variables();
 void init_threads();
-void resetHandler();
 
 //ball functions
 
@@ -206,6 +288,22 @@ void recalculate_angle();
 void set_brick_collision_protocol(int ROW_ID, int COL_ID);
 int check_collision_bar(int cursor_bar_local, int * xcoordinate, int * ycoordinate);
 
+//mailbox
+void timer_init();
+unsigned int timestamp();
+unsigned int timestamp_diff_us(unsigned int from, unsigned int to);
+void mbox_send(msg_header *header, size_t msgsize, int type, int channel);
+void mbox_send_control(int game_status);
+void mbox_send_event(int event, int arg);
+int mbox_headerok(msg_header *header);
+int mbox_receive(msg_any *msg);
+int mbox_wait(msg_any *msg);
+void mbox_printstats(char *side);
+void hist_add(latency_hist *hist, unsigned int us);
+void hist_print(char *name, latency_hist *hist);
+void paddle_read();
+void paddle_printstats();
+
 /************************** Variable Definitions ****************************/
 
 // mailbox declaration
@@ -213,10 +311,24 @@ int check_collision_bar(int cursor_bar_local, int * xcoordinate, int * ycoordina
 #define MY_CPU_ID XPAR_CPU_ID
 #define MBOX_DEVICE_ID		XPAR_MBOX_0_DEVICE_ID
 static XMbox Mbox;	/* Instance of the Mailbox driver */
+mbox_stats mboxstats;
+pthread_mutex_t mbox_mutex;	// one sender at a time
+sem_t sem_inbox;			// counts messages queued by thread_mbox on any channel
+
+// timer declaration
+#ifdef XPAR_TMRCTR_0_DEVICE_ID
+#define TIMER_DEVICE_ID XPAR_TMRCTR_0_DEVICE_ID
+#define TIMER_COUNTS_PER_US (XPAR_TMRCTR_0_CLOCK_FREQ_HZ / 1000000)
+XTmrCtr Timer;
+#else
+#define TIMER_COUNTS_PER_US 1	// falls back to xget_clock_ticks, 10ms resolution
+#endif
 
 //HW Mutex
 #define MUTEX_DEVICE_ID XPAR_MUTEX_0_IF_0_DEVICE_ID
 #define MUTEX_NUM 0
+#define PADDLE_MUTEX_NUM 1		// user register holds the paddle word
+#define PADDLE_TIME_MUTEX_NUM 2	// user register holds timestamp() of the input behind the paddle word
 XMutex mutex;
 
 
@@ -227,12 +339,16 @@ pthread_mutex_t brickcollisionprotocol_mutex;
 
 // threads declaration
 //ball threads
-pthread_t tid1, treset;
+pthread_t tid1, tmbox;
 
 
 //global variables
 // to be received from display
 signed int cursor_curr;			// absolute position
+unsigned int paddle_seq;			// sequence number of the paddle word in use
+unsigned int paddle_input_time;	// timestamp() of the input behind cursor_curr
+int paddle_input_pending;		// cursor_curr changed since the last physics step
+latency_hist paddle_latency;	// input to the first physics step that checks the bar with it
 signed int game_score;
 int gamestateflag;
 
@@ -280,6 +396,8 @@ int poweruplengthen;
 void* thread_func_1 () {
 	msg_ball msg_ball_tosend;
 	msg_game msg_game_rcd;
+	msg_any msg_rcd;
+	int channel;
 	int score_nextlevel = 10;
 	int poweruphold = 0;
 	//int poweruplengthen = 0;
@@ -287,8 +405,6 @@ void* thread_func_1 () {
 	int ballthread_timestamp;
 	int ballthread_timestamp2;
 	int ballthread_timeinterval;
-	int ballthread_finishtimestamp;
-	int ballthread_finishinterval;
 
 	while (1) {
 
@@ -296,6 +412,15 @@ void* thread_func_1 () {
 		//gamestateflag can only be GAME_NORMAL here
 		// if not will not reach here
 
+#if PADDLE_DIRECT
+		paddle_read();
+#endif
+		if (paddle_input_pending == 1)
+		{
+			paddle_input_pending = 0;
+			hist_add(&paddle_latency, timestamp_diff_us(paddle_input_time, timestamp()));
+		}
+
 		//ensure that message from GAME is received before proceeding
 		//while(gamemessage_received!=1);
 		//gamemessage_received = 0;
@@ -319,7 +444,6 @@ void* thread_func_1 () {
 
 
 		//don't need mutex for following sections strictly speaking
-		msg_ball_tosend.message_for = MESSAGE_FOR_GAME;
 		msg_ball_tosend.ballx = global_x;
 		msg_ball_tosend.bally = global_y;
 		msg_ball_tosend.brickrow = communicate_collidedbrick_row;
@@ -327,21 +451,7 @@ void* thread_func_1 () {
 		msg_ball_tosend.speed = SPEED;
 
 
-		XMbox_WriteBlocking(&Mbox, &msg_ball_tosend, sizeof(msg_ball));
-		//XMutex_Lock(&mutex, MUTEX_NUM);
-		//xil_printf("-- Sucessfully send from BALL to GAME --\r\n");
-		//XMutex_Unlock(&mutex, MUTEX_NUM);
-
-		/*
-		ballthread_timestamp2 = xget_clock_ticks();
-		ballthread_timeinterval = ballthread_timestamp2 - ballthread_timestamp;
-		pthread_mutex_lock(&uart_mutex);
-		//xil_printf("new ball packet no. %d sent %d * 10 milliseconds after previous send \n\n", send_packet_no, ballthread_timeinterval);
-		pthread_mutex_unlock(&uart_mutex);
-
-		ballthread_timestamp = xget_clock_ticks();
-		send_packet_no += 1;
-		*/
+		mbox_send(&msg_ball_tosend.header, sizeof(msg_ball), MSG_TYPE_BALL, CHANNEL_STATE);
 
 		if (communicate_collidedbrick_row == BOTTOM_HIT)
 		{
@@ -353,44 +463,60 @@ void* thread_func_1 () {
 	//sleep(10);	//is this sleep needed [debug]
 
 	do{
-		// GAME_LOSE + GAME_WIN will block at read
-		// GAME_PAUSE wiil take in msg and blocked at read
-		XMbox_ReadBlocking(&Mbox, &msg_game_rcd, sizeof(msg_game));
-
-		  if (poweruphold==1 && communicate_collidedbrick_row== BAR_HIT)
-		  {
-			  global_x = msg_game_rcd.ballheldx;
-			  angle_origin_x = global_x;
-		  }
-		//XMutex_Lock(&mutex, MUTEX_NUM);
-		//xil_printf("-- Sucessfully received in BALL from GAME --\r\n");
-		//XMutex_Unlock(&mutex, MUTEX_NUM);
-
-		//debug
-		if (msg_game_rcd.message_for == MESSAGE_FOR_GAME)
+		// GAME_LOSE + GAME_WIN will block here until the reset arrives
+		// GAME_PAUSE + GAME_BALLHELD are held here until the game resumes and sends its update
+		// control messages are taken ahead of anything queued for state
+		channel = mbox_wait(&msg_rcd);
+
+		if (channel == CHANNEL_CONTROL)
 		{
-			XMutex_Lock(&mutex, MUTEX_NUM);
-			xil_printf("-- Error - BALL received message meant for GAME!! --\r\n");
-			XMutex_Unlock(&mutex, MUTEX_NUM);
-			while(1); //stall here
+			gamestateflag = msg_rcd.control.game_status;
+		}
+		else if (channel == CHANNEL_EVENT)
+		{
+			if (msg_rcd.event.event == EVENT_DUMPSTATS)
+			{
+				mbox_printstats("BALL");
+				paddle_printstats();
+			}
+		}
+		else if (channel == CHANNEL_STATE)
+		{
+			msg_game_rcd = msg_rcd.game;
+
+			  if (poweruphold==1 && communicate_collidedbrick_row== BAR_HIT)
+			  {
+				  global_x = msg_game_rcd.ballheldx;
+				  angle_origin_x = global_x;
+			  }
+			//might need mutex protection
+#if PADDLE_DIRECT == 0
+			cursor_curr = msg_game_rcd.bar_position;
+			if (msg_game_rcd.bar_time != paddle_input_time)
+			{
+				paddle_input_time = msg_game_rcd.bar_time;
+				paddle_input_pending = 1;
+			}
+#endif
+			game_score = msg_game_rcd.score;
+			poweruphold = msg_game_rcd.poweruphold;
+			poweruplengthen = msg_game_rcd.poweruplengthen;
 		}
-		//might need mutex protection
-		cursor_curr = msg_game_rcd.bar_position;
-		game_score = msg_game_rcd.score;
-		gamestateflag = msg_game_rcd.game_status;
-		poweruphold = msg_game_rcd.poweruphold;
-		poweruplengthen = msg_game_rcd.poweruplengthen;
 
-	}while (gamestateflag == GAME_PAUSE);
+	}while (gamestateflag != GAME_RESET &&
+		(channel != CHANNEL_STATE || gamestateflag == GAME_PAUSE || gamestateflag == GAME_BALLHELD));
 
 	if(gamestateflag == GAME_RESET)
 	{
-		resetHandler();
-		pthread_mutex_lock(&uart_mutex);
-		xil_printf("func 1 exiting..\n\n");
-		pthread_mutex_unlock(&uart_mutex);
-		pthread_exit(0);
-
+		// second half of the game's two-phase reset, re-init in place, ack and wait for the go
+		init_variables();
+		score_nextlevel = 10;
+		poweruphold = 0;
+		mbox_send_control(GAME_READY);
+		do{
+			channel = mbox_wait(&msg_rcd);
+		}while (channel != CHANNEL_CONTROL || msg_rcd.control.game_status != GAME_NORMAL);
+		continue;
 	}
 	// only will go into next iteration if gamestateflag == GAME_NORMAL
 
@@ -404,9 +530,6 @@ void* thread_func_1 () {
 
 	ballthread_timestamp2 = xget_clock_ticks();
 	ballthread_timeinterval = ballthread_timestamp2 - ballthread_timestamp;
-	//pthread_mutex_lock(&uart_mutex);
-	//xil_printf("time taken for iteration of ballthread to complete is %d*10 milliseconds \n\n", ballthread_timeinterval);
-	//pthread_mutex_unlock(&uart_mutex);
     if (ballthread_timeinterval == 0)
     	sleep(40);
     else if (ballthread_timeinterval==1)
@@ -424,34 +547,28 @@ void* thread_func_1 () {
 
 
 
-void* thread_reset()
+// mailbox dispatcher, drains the fifo into one msgqueue per channel
+// launched once in main_prog, keeps running across resets
+void* thread_mbox()
 {
-	//attempts to lock, then unlock all mutex
-	pthread_mutex_trylock(&uart_mutex);
-	pthread_mutex_unlock(&uart_mutex);
-
-	pthread_mutex_trylock(&flagset_mutex);
-	pthread_mutex_unlock(&flagset_mutex);
-
-	pthread_mutex_trylock(&brickcollisionprotocol_mutex);
-	pthread_mutex_unlock(&brickcollisionprotocol_mutex);
-
-	//reset hwmutex deubg
-
-	pthread_mutex_lock(&uart_mutex);
-	xil_printf("mutex reset, reset thread1 sleeping...\n\n");
-	pthread_mutex_unlock(&uart_mutex);
-
-	sleep(40); //buffer time to let other threads die
-
-	init_variables();
-	init_threads();
+	msg_any msg_recd;
+	int channel;
+	int msgid;
 
-	pthread_mutex_lock(&uart_mutex);
-	xil_printf("thread reset1 about exiting..\n\n");
-	pthread_mutex_unlock(&uart_mutex);
+	while(1)
+	{
+		channel = mbox_receive(&msg_recd);
 
-	pthread_exit(0);
+		msgid = msgget(CHANNEL_Q + channel, IPC_CREAT);
+		if (msgsnd(msgid, &msg_recd, sizeof(msg_any), 0) < 0)
+		{
+			XMutex_Lock(&mutex, MUTEX_NUM);
+			xil_printf("-- Error - BALL could not queue message on channel %d --\r\n", channel);
+			XMutex_Unlock(&mutex, MUTEX_NUM);
+			continue;
+		}
+		sem_post(&sem_inbox);
+	}
 }
 
 int main(void) {
@@ -503,6 +620,11 @@ int main_prog(void) { // This thread is statically created (as configured in the
 		return NULL;
 	}
 
+	timer_init();
+
+	pthread_mutex_init(&mbox_mutex, NULL);
+	sem_init(&sem_inbox, 1, 0);
+
 
 	//ball
 	ret = pthread_mutex_init (&flagset_mutex, NULL);
@@ -519,6 +641,13 @@ int main_prog(void) { // This thread is statically created (as configured in the
 
 	init_variables();
 	init_threads();
+
+	// the mailbox dispatcher survives resets, so launched once here rather than in init_threads
+	ret = pthread_create(&tmbox, NULL, (void*) thread_mbox, NULL);
+	if (ret != 0)
+	{
+		xil_printf("-- ERROR (%d) launching thread_mbox...\r\n", ret);
+	}
 	return NULL;
 
 }
@@ -605,24 +734,6 @@ xil_printf(" Finished init_threads.\r\n");
 pthread_mutex_unlock(&uart_mutex);
 }
 
-void resetHandler()
-{
-	int ret;
-
-	//launches thread_reset which will carry out the reset operation
-	ret = pthread_create(&treset, NULL, (void*) thread_reset, NULL);
-	if (ret != 0)
-	{
-		xil_printf("-- ERROR (%d) launching thread_reset...\r\n", ret);
-	}
-	else
-	{
-		xil_printf("thread_reset launched with ID %d \r\n", treset);
-	}
-}
-
-
-
 //generic functions: ball
 
 
@@ -1730,3 +1841,249 @@ int check_collision_bar(int cursor_bar_local, int * xcoordinate, int * ycoordina
    }// barlengthen if condition end
 
 }
+
+// picks up the bar position game has published, if it has published one
+void paddle_read()
+{
+	u32 word;
+	u32 input_time;
+	u32 check;
+
+	// the time is written just before the word, reading the word on both sides keeps them together
+	do{
+		XMutex_GetUser(&mutex, PADDLE_MUTEX_NUM, &word);
+		XMutex_GetUser(&mutex, PADDLE_TIME_MUTEX_NUM, &input_time);
+		XMutex_GetUser(&mutex, PADDLE_MUTEX_NUM, &check);
+	}while (check != word);
+
+	if ((word & PADDLE_VALID) == 0 || PADDLE_SEQ(word) == paddle_seq)
+	{
+		return;
+	}
+	paddle_seq = PADDLE_SEQ(word);
+	cursor_curr = PADDLE_POS(word);
+	paddle_input_time = input_time;
+	paddle_input_pending = 1;
+}
+
+void paddle_printstats()
+{
+	pthread_mutex_lock(&uart_mutex);
+	XMutex_Lock(&mutex, MUTEX_NUM);
+	xil_printf("-- BALL paddle input, %s --\r\n", PADDLE_DIRECT ? "direct" : "through msg_game");
+	hist_print("input to collision check", &paddle_latency);
+	XMutex_Unlock(&mutex, MUTEX_NUM);
+	pthread_mutex_unlock(&uart_mutex);
+}
+
+//
+//	Mailbox Functions
+//
+
+// game owns the timer, ball only looks it up so that the count is not restarted
+void timer_init()
+{
+#ifdef XPAR_TMRCTR_0_DEVICE_ID
+	XTmrCtr_Config *TimerConfigPtr;
+
+	TimerConfigPtr = XTmrCtr_LookupConfig(TIMER_DEVICE_ID);
+	XTmrCtr_CfgInitialize(&Timer, TimerConfigPtr, TimerConfigPtr->BaseAddress);
+#endif
+}
+
+// raw timer counts, wraps around
+unsigned int timestamp()
+{
+#ifdef XPAR_TMRCTR_0_DEVICE_ID
+	return XTmrCtr_GetValue(&Timer, 0);
+#else
+	return xget_clock_ticks() * 10000;
+#endif
+}
+
+unsigned int timestamp_diff_us(unsigned int from, unsigned int to)
+{
+	return (to - from) / TIMER_COUNTS_PER_US;	// unsigned subtraction handles the wrap around
+}
+
+void mbox_send(msg_header *header, size_t msgsize, int type, int channel)
+{
+	// more than one thread sends, a message has to go into the fifo in one piece
+	pthread_mutex_lock(&mbox_mutex);
+	header->type = type;
+	header->channel = channel;
+	header->size = msgsize;
+	header->seq = mboxstats.sent;
+	header->echo = mboxstats.last_timestamp;
+	header->timestamp = timestamp();
+	XMbox_WriteBlocking(&Mbox, (u32 *) header, msgsize);
+	mboxstats.sent++;
+	pthread_mutex_unlock(&mbox_mutex);
+}
+
+void mbox_send_control(int game_status)
+{
+	msg_control msg_control_tosend;
+
+	msg_control_tosend.game_status = game_status;
+	mbox_send(&msg_control_tosend.header, sizeof(msg_control), MSG_TYPE_CONTROL, CHANNEL_CONTROL);
+}
+
+void mbox_send_event(int event, int arg)
+{
+	msg_event msg_event_tosend;
+
+	msg_event_tosend.event = event;
+	msg_event_tosend.arg = arg;
+	mbox_send(&msg_event_tosend.header, sizeof(msg_event), MSG_TYPE_EVENT, CHANNEL_EVENT);
+}
+
+// a header the rest of its message can be read after: known type and channel, and a size
+// XMbox_ReadBlocking takes, whole words from the header up to the largest message
+int mbox_headerok(msg_header *header)
+{
+	return header->type >= MSG_TYPE_BALL && header->type <= MSG_TYPE_EVENT &&
+		header->channel >= 0 && header->channel < NUM_CHANNELS &&
+		header->size >= (int) sizeof(msg_header) && header->size <= (int) sizeof(msg_any) &&
+		header->size % 4 == 0;
+}
+
+// reads the next message off the fifo, whatever its type
+// after a bad header the length of the rest is unknown and the fifo is out of step, so words
+// are dropped one at a time until the ones at the front read as a header again
+// returns its channel
+int mbox_receive(msg_any *msg)
+{
+	u32 *words = (u32 *) &msg->header;
+	unsigned int now;
+	int seqdiff;
+	int channel;
+	int i;
+
+	XMbox_ReadBlocking(&Mbox, words, sizeof(msg_header));
+	if (mbox_headerok(&msg->header) == 0)
+	{
+		mboxstats.misrouted++;
+		XMutex_Lock(&mutex, MUTEX_NUM);
+		xil_printf("-- Error - BALL got a bad header: type %d channel %d size %d, seq %d, resyncing --\r\n",
+			msg->header.type, msg->header.channel, msg->header.size, msg->header.seq);
+		XMutex_Unlock(&mutex, MUTEX_NUM);
+		do
+		{
+			for (i = 0; i < (int) (sizeof(msg_header) / 4) - 1; i++)
+			{
+				words[i] = words[i + 1];
+			}
+			XMbox_ReadBlocking(&Mbox, &words[i], 4);
+			mboxstats.skipped++;
+		} while (mbox_headerok(&msg->header) == 0);
+	}
+	now = timestamp();
+	mboxstats.received++;
+
+	if (msg->header.size > (int) sizeof(msg_header))
+	{
+		XMbox_ReadBlocking(&Mbox, (u32 *) (&msg->header + 1), msg->header.size - sizeof(msg_header));
+	}
+
+	channel = msg->header.channel;
+	mboxstats.channel_received[channel]++;
+
+	seqdiff = (int) (msg->header.seq - mboxstats.expected_seq);
+	if (seqdiff > 0)
+	{
+		mboxstats.gaps += seqdiff;
+	}
+	if (seqdiff < 0)
+	{
+		mboxstats.reordered++;
+	}
+	else
+	{
+		mboxstats.expected_seq = msg->header.seq + 1;
+	}
+
+	hist_add(&mboxstats.oneway, timestamp_diff_us(msg->header.timestamp, now));
+	if (msg->header.echo != 0)
+	{
+		hist_add(&mboxstats.roundtrip, timestamp_diff_us(msg->header.echo, now));
+	}
+	mboxstats.last_timestamp = msg->header.timestamp;
+
+	return channel;
+}
+
+// blocks until the dispatcher has queued a message on any channel
+// control is taken first, then events, then state, so a pause or reset never waits behind frames
+// returns the channel the message came from
+int mbox_wait(msg_any *msg)
+{
+	int channel;
+	int msgid;
+
+	sem_wait(&sem_inbox);	// posted once per queued message, so one of the queues has something
+	for (channel = 0; channel < NUM_CHANNELS; channel++)
+	{
+		msgid = msgget(CHANNEL_Q + channel, IPC_CREAT);
+		if (msgrcv(msgid, msg, sizeof(msg_any), 0, IPC_NOWAIT) == sizeof(msg_any))
+		{
+			return channel;
+		}
+	}
+	return -1;
+}
+
+void mbox_printstats(char *side)
+{
+	pthread_mutex_lock(&uart_mutex);
+	XMutex_Lock(&mutex, MUTEX_NUM);
+	xil_printf("-- %s mailbox: sent %d received %d gaps %d reordered %d misrouted %d (%d words skipped) --\r\n", side,
+		mboxstats.sent, mboxstats.received, mboxstats.gaps, mboxstats.reordered, mboxstats.misrouted, mboxstats.skipped);
+	xil_printf("  by channel: control %d event %d state %d\r\n", mboxstats.channel_received[CHANNEL_CONTROL],
+		mboxstats.channel_received[CHANNEL_EVENT], mboxstats.channel_received[CHANNEL_STATE]);
+	hist_print("one-way", &mboxstats.oneway);
+	hist_print("round-trip", &mboxstats.roundtrip);
+	XMutex_Unlock(&mutex, MUTEX_NUM);
+	pthread_mutex_unlock(&uart_mutex);
+}
+
+void hist_add(latency_hist *hist, unsigned int us)
+{
+	int i = 0;
+
+	while ((us >> (i + 1)) != 0 && i < HIST_BUCKETS - 1)
+	{
+		i++;
+	}
+	hist->bucket[i]++;
+
+	if (hist->count == 0 || us < hist->min)
+		hist->min = us;
+	if (us > hist->max)
+		hist->max = us;
+	hist->sum += us;
+	hist->count++;
+}
+
+void hist_print(char *name, latency_hist *hist)
+{
+	int i;
+
+	if (hist->count == 0)
+	{
+		xil_printf("  %s: no samples\r\n", name);
+		return;
+	}
+
+	xil_printf("  %s: n %d min %d avg %d max %d us\r\n", name,
+		hist->count, hist->min, (unsigned int) (hist->sum / hist->count), hist->max);
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		if (hist->bucket[i] == 0)
+			continue;
+		if (i == HIST_BUCKETS - 1)
+			xil_printf("   >= %d us : %d\r\n", 1 << i, hist->bucket[i]);
+		else
+			xil_printf("    < %d us : %d\r\n", 1 << (i + 1), hist->bucket[i]);
+	}
+}
@@ -0,0 +1,41 @@
+/*
+ * Frame and latency counters kept by game_receiver.c, shared with the host
+ * benchmarks that read framestats so both see the same layout.
+ */
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#define HIST_BUCKETS 20			// bucket i counts samples in [2^i, 2^(i+1)) us, last bucket takes the rest
+
+typedef struct {
+	unsigned int count;
+	unsigned int min;
+	unsigned int max;
+	unsigned long long sum;
+	unsigned int bucket[HIST_BUCKETS];
+} latency_hist;
+
+typedef struct {
+	unsigned int presented;		// frames put on screen
+	unsigned int copied;		// pixels copied to bring the back frame up to the one on screen
+	unsigned int locks;			// tft_mutex acquisitions
+	unsigned int primitives;	// boxes, sprites, patterns and texts recorded, each took tft_mutex on its own before
+	unsigned int drawn;			// pixels the primitives cover, what drawing them one by one writes
+	unsigned int written;		// pixels tft_compose stored to video memory
+	unsigned int loaded;		// pixels render_screen copied back from the snapshot, screen and background layer
+	unsigned int last_present;	// timestamp() of the previous present
+	latency_hist frametime;		// between presents
+	latency_hist vsyncwait;		// from the address write until the TFT latched it
+	unsigned int last_interval;	// previous frame time
+	latency_hist jitter;		// change in frame time from one frame to the next
+	unsigned int missedvsync;	// refreshes a posted frame was ready for but not latched at
+	unsigned int merged;		// presents skipped because a later frame was already posted
+	unsigned int hudcells;		// glyph cells hud_number drew
+	unsigned int hudboxes;		// pixels of the HUD boxes it changed, what redrawing them whole writes
+	unsigned int tiled;			// areas composed in tiles by more than one thread
+	unsigned int expanded;		// TFT_PALETTE, pixels expanded from indices into the frames
+} frame_stats;
+
+extern frame_stats framestats;
+
+#endif
@@ -45,7 +45,6 @@
 *			- more timing to increase game performance
 * 			- inter-processors mailbox communication
 * 			- starting sync
-* 			- fix "chipoff" problem at top/btm edges
 * 			- check if bar speed/ball speed are as intended
 * 			- if brickthreads need to be 10 separate threads
 * 			- reset game functionality
@@ -69,6 +68,7 @@
 * - pause/resume
 * - win and lose conditions
 * - prevent "chipoff" on left/right edges of gamearea
+* - fix "chipoff" at top/btm edges, ball and bar are erased from the background layer
 * - coloured sections for bar
 * - make red colums change randomly
 * - ball logic/ reduce ball passing through bricks
@@ -89,12 +89,18 @@
 #include <sys/ipc.h>
 #include <sys/timer.h>
 #include <sys/intr.h> //xilkernel api for interrupts
+#include <sys/process.h> //yield
 #include <stdio.h>
 #include <stdint.h>
 #include <time.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include "xuartps.h" //replace xuart_lite.h
+#ifdef XPAR_TMRCTR_0_DEVICE_ID
+#include "xtmrctr.h" //free running timer for mailbox timestamps
+#endif
+#include "frame_stats.h" //framestats, shared with the host benchmarks
 
 
 /************************** Constant Definitions ****************************/
@@ -131,8 +137,8 @@
 #define CURSOR_RIGHTX 513 //GAMEAREA_RIGHT - HALFBARLENG -1
 
 //msgqueue addresses
-#define DRAWBRICK_Q 	21
 #define GAME_Q 	22
+#define CHANNEL_Q	23	// CHANNEL_Q + channel, one msgqueue per mailbox channel
 
 //colour
 #define BRICK_COLOUR 0x00ffff00	//yellow
@@ -154,10 +160,56 @@
 #define GAME_PAUSE 3
 #define GAME_RESET 4
 #define GAME_BALLHELD 5
-
-//message for
-#define MESSAGE_FOR_BALL 0
-#define MESSASGE_FOR_GAME 1
+#define GAME_READY 6	// control message only, ball has reset and waits for GAME_NORMAL
+#define GAME_MASK(state) (1u << (state))	// for game_wait
+#define GAME_WAITERS 2					// threads that block in game_wait, one semaphore each
+#define WAITER_GAME 0
+#define WAITER_BAR 1
+#define BUTTON_RING 8					// presses gpPBIntHandler can queue for thread_buttons
+
+//message type
+#define MSG_TYPE_BALL 1			// ball position and collisions, ball -> game
+#define MSG_TYPE_GAME 2			// bar, score and powerups, game -> ball
+#define MSG_TYPE_CONTROL 3		// game state changes (pause, resume, ballheld, win, reset)
+#define MSG_TYPE_EVENT 4		// one-off notifications that are not part of a frame
+
+//mailbox channels, lower number is taken first by mbox_wait
+#define CHANNEL_CONTROL 0
+#define CHANNEL_EVENT 1
+#define CHANNEL_STATE 2
+#define NUM_CHANNELS 3
+
+//events
+#define EVENT_DUMPSTATS 1		// ask the other side to print its mailbox stats
+
+//mailbox stats
+#define STATS_KEY 's'			// key to press on the uart to dump the stats
+
+//stage timing
+#ifndef STAGE_TIMING
+#define STAGE_TIMING 1			// 0 compiles the stage timestamps out
+#endif
+#define STAGES_KEY 't'			// key to press on the uart for the stage percentiles, they start over after
+#define STAGE_SUB 8				// buckets per power of two, a bucket is at most 1/8 wide
+#define STAGE_BUCKETS (30 * STAGE_SUB)	// up to 2^32 ns
+#define STAGE_MBOXWAIT 0		// thread_game waiting for ball's state
+#define STAGE_UPDATE 1			// thread_game from ball's state to posting the frame
+#define STAGE_COLLISION 2		// thread_game handling a brick hit, the brick send included
+#define STAGE_BRICKSEND 3		// thread_game posting the hit brick to thread_render
+#define STAGE_STATESEND 4		// thread_game sending the bar and score to ball
+#define STAGE_BALLDRAW 5		// thread_render recording the ball move
+#define STAGE_BRICKDRAW 6		// thread_render drawing bricks into the background layer and recording them
+#define STAGE_HUDDRAW 7			// thread_render recording a HUD number
+#define STAGE_COMPOSE 8			// tft_present composing a frame, before the vsync wait
+#define NUM_STAGES 9
+
+#if STAGE_TIMING
+#define STAGE_BEGIN(start) ((start) = timestamp())
+#define STAGE_END(stage, start) stage_add(stage, timestamp() - (start))
+#else
+#define STAGE_BEGIN(start) ((void) &(start))	// only marks the timestamp used
+#define STAGE_END(stage, start) ((void) &(start))
+#endif
 
 //buttons
 #define BTN_CENTER 1
@@ -185,24 +237,131 @@
 #define BOTTOM_HIT 20
 #define BAR_HIT 24
 
+//paddle word, published by game in a hw mutex user register and read by ball at every physics step
+#define PADDLE_VALID 0x80000000	// clear until game has published once
+#define PADDLE_WORD(pos, seq) (PADDLE_VALID | (((seq) & 0xff) << 10) | ((pos) & 0x3ff))
+#define PADDLE_POS(word) ((word) & 0x3ff)
+#define PADDLE_SEQ(word) (((word) >> 10) & 0xff)
+
 /**
 * User has to specify a 2MB memory space for filling the frame data.
 * This constant has to be updated based on the memory map of the
 * system.
 */
+// DDR from TFT_FRAME_ADDR is laid out in TFT_FRAMES frames of TFT_FRAME_SIZE, 0x10000000 to 0x109FFFFF,
+// or to 0x10DFFFFF with TFT_PALETTE:
+//   0, 1  the frames the TFT scans out, only 0 single buffered
+//   2     background layer
+//   3     snapshot of the initial screen
+//   4     snapshot of the background layer
+//   5     TFT_PALETTE only, index frame composed into
+//   6     TFT_PALETTE only, scratch frame XTft_Write draws text into
+// neither processor's program may be linked into it
 #define TFT_FRAME_ADDR        0x10000000
+#define TFT_FRAME_SIZE        0x200000	// second frame follows the first
+#define TFT_BACKGROUND_ADDR   (TFT_FRAME_ADDR + 2*TFT_FRAME_SIZE)	// game area and bricks without the ball and bar, never shown
+#define TFT_SNAPSHOT_ADDR     (TFT_FRAME_ADDR + 3*TFT_FRAME_SIZE)	// initial screen without the crystal bricks, ball and bar
+#define TFT_BGSNAPSHOT_ADDR   (TFT_FRAME_ADDR + 4*TFT_FRAME_SIZE)	// background layer as it was then
+
+#ifndef TFT_PALETTE
+#define TFT_PALETTE 0		// 1 composes into 8 bit palette indices, only what is put on screen is expanded to 0x00RRGGBB
+#endif
+#if TFT_PALETTE
+#define TFT_INDEX_ADDR        (TFT_FRAME_ADDR + 5*TFT_FRAME_SIZE)	// frame composed into, a byte per pixel, the layers above too
+#define TFT_TEXT_ADDR         (TFT_FRAME_ADDR + 6*TFT_FRAME_SIZE)	// XTft_Write draws here, text is indexed from it
+#define TFT_COMPOSE_ADDR(Tft) TFT_INDEX_ADDR
+#define TFT_PALETTE_SIZE 256
+#define TFT_KEY 0			// palette index of SPRITE_KEY
+#define TFT_FRAMES 7
+#else
+#define TFT_TEXT_ADDR         TFT_BACKGROUND_ADDR	// XTft_Write draws into the top left, outside the game area
+#define TFT_COMPOSE_ADDR(Tft) ((Tft)->TftConfig.VideoMemBaseAddr)
+#define TFT_KEY SPRITE_KEY
+#define TFT_FRAMES 5
+#endif
+
+#if defined(XPAR_PS7_DDR_0_S_AXI_HIGHADDR) && TFT_FRAME_ADDR + TFT_FRAMES * TFT_FRAME_SIZE - 1 > DDR_HIGH_ADDR
+#error "the TFT frames run past DDR_HIGH_ADDR"
+#endif
+
+#ifndef DOUBLE_BUFFER
+#define DOUBLE_BUFFER 1		// draw into the frame off screen and flip at vsync, 0 draws straight into the one on screen
+#endif
+#define TFT_REFRESH_US 16667	// 60 Hz panel, one vsync every refresh
+#define MAX_DAMAGE 32		// rectangles remembered per frame, beyond that the whole screen is copied
+#define MAX_DRAWCMDS 160	// primitives recorded before they are composed, RENDER_SCREEN takes about 150
+#define MAX_SPANS 16		// separate runs of drawn pixels in one composed row
+#ifndef TFT_TILE_THREADS
+#define TFT_TILE_THREADS 1	// threads composing a large area in tiles, the board has one core
+#endif
+#define TFT_TILE_WIDTH 160	// 4 tiles across the screen
+#define TFT_TILE_HEIGHT 32	// 15 down
+#define TFT_TILE_MIN 32768	// pixels in an area before it is split into tiles, a smaller one is not worth waking the workers
+
+// primitives recorded by the drawing functions, drawn by tft_compose
+#define DRAWCMD_FILL 0
+#define DRAWCMD_SPRITE 1
+#define DRAWCMD_PATTERN 2
+#define DRAWCMD_TEXT 3
+#define DRAWCMD_MOVE 4
+#define DRAWCMD_RESTORE 5
+
+#define NUM_SPRITES 3
+#define BRICK_TILE_RED 1		// brick_tile[] index bits
+#define BRICK_TILE_CRYSTAL 2
+
+#define HUD_FPS 0				// hud[] fields
+#define HUD_SCORE 1
+#define HUD_TIME 2
+#define HUD_SPEED 3
+#define HUD_BRICKS 4
+#define HUD_FIELDS 5
+#define HUD_GLYPHS 11			// digits, then a blank cell
+#define HUD_BLANK 10
+
+// commands posted to thread_render
+#define RENDER_BALL 0			// ball to x, y
+#define RENDER_BAR 1			// bar to cursor, lengthened or not
+#define RENDER_BRICK 2			// brick column update, as msg_col
+#define RENDER_HUD 3			// hud field to a number
+#define RENDER_TEXT 4			// text box
+#define RENDER_RESTORE 5		// background back over a box
+#define RENDER_SCREEN 6			// whole initial game screen
+#define RENDER_PRESENT 7		// put what was drawn on screen
+#define RENDER_RING_SIZE 64		// power of two
+
+#define SPRITE_KEY 0xff000000	// transparent sprite pixel, the TFT only shows the low 24 bits
+#define MAX_SPRITE_ROWS 16
 
 /**************************** Type Definitions ******************************/
+#if TFT_PALETTE
+typedef u8 tft_pixel;			// index into tft_palette
+#else
+typedef u32 tft_pixel;			// 0x00RRGGBB, what the TFT shows
+#endif
+
 
 typedef struct {
 	int id;
 	int status;
 	int isRed;
+	int row;					// 1-8 repaints that brick only, 0 the live bricks of the column
+	unsigned int generation;	// reset_generation when sent, older ones are dropped
 } msg_col;
 
 
+// common header in front of every mailbox message
+typedef struct {
+	int type;					// MSG_TYPE_*
+	int channel;				// CHANNEL_*, the msgqueue the dispatcher delivers it to
+	int size;					// whole message in bytes, header included
+	unsigned int seq;			// sequence number, per sender
+	unsigned int timestamp;		// timestamp() at send
+	unsigned int echo;			// timestamp of the last message received from the other side, 0 if none
+} msg_header;
+
 typedef struct {
-	int message_for;
+	msg_header header;
 	int ballx;
 	int bally;
 	int brickrow;
@@ -211,24 +370,163 @@ typedef struct {
 } msg_ball;
 
 typedef struct {
-	int message_for;
+	msg_header header;
 	int bar_position;
 	int score;
-	int game_status;
 	int poweruphold;
 	int poweruplengthen;
 	int ballheldx;
+	unsigned int bar_time;		// timestamp() of the input that put the bar at bar_position
 } msg_game;	//debug - try removing the dummy data if mailbox is always in order
 
+typedef struct {
+	msg_header header;
+	int game_status;
+} msg_control;
+
+typedef struct {
+	msg_header header;
+	int event;					// EVENT_*
+	int arg;
+} msg_event;
+
+// large enough for any message, what the dispatcher reads into and queues
+typedef union {
+	msg_header header;
+	msg_ball ball;
+	msg_game game;
+	msg_control control;
+	msg_event event;
+} msg_any;
+
+// fixed buckets fine enough for percentiles, each stage is added to by one thread only
+typedef struct {
+	unsigned int count;
+	unsigned int max;
+	unsigned long long sum;
+	unsigned int bucket[STAGE_BUCKETS];	// see stage_bucket
+} stage_hist;
+
+typedef struct {
+	unsigned int sent;
+	unsigned int received;
+	unsigned int expected_seq;	// next sequence number expected from the other side
+	unsigned int gaps;			// messages skipped over
+	unsigned int reordered;		// messages older than one already received
+	unsigned int misrouted;		// bad headers, each one leaves the fifo out of step until mbox_receive resyncs
+	unsigned int skipped;		// words dropped while resyncing
+	unsigned int channel_received[NUM_CHANNELS];
+	unsigned int last_timestamp;	// echoed back in the next message sent
+	latency_hist oneway;		// only meaningful if both processors read the same timer
+	latency_hist roundtrip;
+} mbox_stats;
+
+typedef struct {
+	int x1;
+	int y1;
+	int x2;
+	int y2;
+} tft_rect;
+
+// rendered once by sprite_init, drawn by copying rows
+typedef struct {
+	int width;
+	int height;
+	tft_pixel *pixels;			// width * height, TFT_KEY where transparent
+	int left[MAX_SPRITE_ROWS];	// first and last pixel in each row that is not transparent
+	int right[MAX_SPRITE_ROWS];
+	int masked;					// some row has a transparent pixel between left and right
+	int solid;					// every pixel that is not transparent has the same colour
+	tft_rect onscreen;			// where tft_compose last drew it
+	int intact;					// nothing was drawn over it there since
+} tft_sprite;
+
+#define MAX_PATTERN 4				// pattern tile width and height at most
+#define PATTERN_ROW (DISPLAY_COLUMNS + MAX_PATTERN)
+
+typedef struct tft_pattern {
+	int width;
+	int height;
+	tft_pixel rows[MAX_PATTERN][PATTERN_ROW];	// each tile row repeated, a span from x starts at x % width
+	int masked;						// has TFT_KEY pixels, they show what is underneath
+	int opaque[MAX_PATTERN][MAX_PATTERN];	// masked, columns of each tile row that are not TFT_KEY
+	int opaque_count[MAX_PATTERN];
+} tft_pattern;
+
+typedef struct {
+	int op;						// DRAWCMD_*
+	tft_rect rect;				// pixels it may touch, on screen
+	unsigned int col;			// DRAWCMD_FILL a tft_pixel from tft_colour, DRAWCMD_TEXT 0x00RRGGBB
+	tft_sprite *sprite;
+	tft_pattern *pattern;
+	int x;						// sprite top left, first text character
+	int y;
+	tft_sprite *oldsprite;		// DRAWCMD_MOVE, what is on screen at ox, oy
+	int ox;
+	int oy;
+	int full;					// DRAWCMD_MOVE, draw all of the new sprite not just what the old one did not cover
+	char text[12];
+} tft_drawcmd;
+
+// the row tft_composerow builds, one for thread_render and one per tile worker
+typedef struct {
+	tft_pixel line[DISPLAY_COLUMNS];	// row being composed
+	int x1[MAX_SPANS];			// runs of line that hold drawn pixels, sorted, apart
+	int x2[MAX_SPANS];
+	int spans;
+	unsigned int drawn;			// added to framestats by tft_compose
+	unsigned int written;
+} tft_composer;
+
+typedef struct {
+	tft_rect box;
+	char shown[12];				// digits on screen
+	int valid;					// 0 until the box is drawn, the whole box is drawn then
+} hud_field;
+
+// one slot of the render ring, arg[] depends on op
+typedef struct {
+	unsigned int seq;			// ring position it is free for, that position + 1 once posted
+	int op;						// RENDER_*
+	int arg[4];
+	char *text;					// RENDER_TEXT, a string constant
+	unsigned int generation;	// RENDER_BRICK, as msg_col
+	unsigned int posted;		// timestamp() when posted
+} render_cmd;
+
+typedef struct {
+	unsigned int taken;			// commands thread_render ran or dropped
+	unsigned int dropped;		// brick updates from before a reset
+	unsigned int fullwaits;		// times a producer found the ring full and yielded
+	unsigned int maxdepth;		// commands queued when thread_render took one, it included
+	unsigned long long depthsum;
+	latency_hist latency;		// from posting until thread_render ran it
+} render_stats;
+
+
+// what the threads, the isr and ball's messages share about the player's side of the game
+// one writer at a time: the pushbutton isr, or a thread between view_lock and view_unlock,
+// which keeps the isr out; readers take a consistent copy with view_read without locking
+typedef struct {
+	int state;					// GAME_*, written by game_transition only
+	int cursor;					// bar centre, absolute position
+	unsigned int input_time;	// timestamp() of the last input that moved the bar
+	unsigned int held_since;	// xget_clock_ticks() when the bar button being held went down
+	unsigned char buttons;		// pushbuttons down at the last interrupt
+	int lengthen;				// bar doubled by a crystal brick
+} game_view;
+
 /************************** Function Prototypes *****************************/
 //threads
 //display
 void* thread_bar(void);						// manages and draws bar
 void* thread_game(void);					// handles collision, draw score/speed/brick/ball
-void* thread_drawbrick(void);			// draws bricks whenever receive new info from msgqueue
-void* thread_bcol1(void);
-void* thread_bcol2(void);
-void* thread_reset(void);
+void* thread_render(void);				// owns the screen, draws what the other threads post to the render ring
+void* thread_red(void);					// turns the red columns at every level up
+void* thread_stats(void);
+void* thread_mbox(void);
+void* thread_buttons(void);				// deferred handler of the presses that change the game state
+
 
 
 //generic function declarations
@@ -241,17 +539,109 @@ static void gpPBIntHandler(void *arg);	// handle pushbutton
 void send(int destid, void *msgptr, size_t msgsize);	// send to msgqueue
 void receive(int msgqid, void* msgptr, size_t msgsize);	// receive from rmsgqueue
 void numbertocstring(int num, char* charptr);	//convert number to null-terminated char string
-void tryRed2(unsigned int redID);
+void red_start();
+void red_levelup();
+void red_choose();
+int red_pick(unsigned int eligible);
+void red_post(int column, int isRed);
 int generatebitmask(int brickrow);
-void resetHandler();
-
-void drawBar(XTft *Tft, int cursor, int* cursor_drawn_ptr, int poweruplengthen_prev);
+void game_reset();
+int game_transition(unsigned int from, int to);
+void game_moveheldball(int dx);
+int game_wait(int waiter, unsigned int mask);
+void game_press(unsigned char val, unsigned int time);
+void view_begin();
+void view_end();
+void view_lock();
+void view_unlock();
+void view_read(game_view *copy);
+void paddle_publish(int cursor);
+
+void drawBar(XTft *Tft, int cursor, int* cursor_drawn_ptr, int poweruplengthen_last, int lengthen);
 void drawBall(XTft *Tft, int x, int y, int* ball_ptr_x, int* ball_ptr_y);
 void drawBCol(XTft *Tft, int bcol_id, int bcol_status, int bcol_isRed);	//draws a single column
+void drawBrick(XTft *Tft, int row, int col, int alive, int isRed);	//draws a single brick
 int XTft_DrawSolidBox(XTft *Tft, int x1, int y1, int x2, int y2, unsigned int col);
 void XTft_DrawTextBox(XTft *Tft, int x1, int y1, int x2, int y2, char* cstringtext);
 void XTft_DrawNumberBox(XTft *Tft, int x1, int y1, int x2, int y2, int someNumber);
 void XTft_DrawSolidCircle(XTft *Tft, int x, int y);
+int XTft_DrawPattern(XTft *Tft, int x1, int y1, int x2, int y2, tft_pattern *pattern);
+void sprite_init();
+void sprite_fill(tft_sprite *sprite, int x1, int x2, unsigned int col);
+void sprite_extents(tft_sprite *sprite);
+void tft_drawsprite(XTft *Tft, tft_sprite *sprite, int x, int y);
+void tft_drawglyph(XTft *Tft, int glyph, int x, int y);
+void hud_init(XTft *Tft);
+void hud_number(XTft *Tft, int field, int number);
+void tft_movesprite(XTft *Tft, tft_sprite *oldsprite, int ox, int oy, tft_sprite *sprite, int x, int y);
+void sprite_rect(tft_sprite *sprite, int x, int y, tft_rect *rect);
+int sprite_span(tft_sprite *sprite, int x, int y, int row, tft_rect *clip, int *x1, int *x2);
+void tft_fillspan(tft_pixel *dst, int count, tft_pixel col);
+void tft_patternspan(tft_pixel *dst, tft_pattern *pattern, int x, int y, int count);
+tft_pixel tft_colour(unsigned int col);
+void pattern_init(tft_pattern *pattern, int width, int height, const u32 *tile);
+void tft_bgbox(int x1, int y1, int x2, int y2, unsigned int col);
+void tft_bgtile(tft_sprite *tile, int x, int y);
+void tft_restore(XTft *Tft, int x1, int y1, int x2, int y2);
+void tft_begin();
+void tft_end();
+void tft_record(XTft *Tft, tft_drawcmd *cmd);
+void tft_addrect(tft_rect *list, int *count, int *full, tft_rect *rect);
+void tft_compose(XTft *Tft);
+void tft_composearea(XTft *Tft, tft_rect *area, int *cmds, int ncmds);
+void tft_composerow(tft_composer *c, XTft *Tft, tft_rect *area, int y, int *cmds, int ncmds);
+void tft_composecover(tft_composer *c, tft_pixel *row, int x1, int x2, int load);
+void tft_composefill(tft_composer *c, tft_pixel *row, int x1, int x2, tft_pixel col);
+void tft_composebg(tft_composer *c, tft_pixel *row, int y, int x1, int x2);
+void tft_composesprite(tft_composer *c, tft_pixel *row, tft_sprite *sprite, int x, int y, int row_y, int x1, int x2);
+#if TFT_TILE_THREADS > 1
+void tft_tilethreads(int threads);
+void tft_composetiles(XTft *Tft, tft_rect *area, int *cmds, int ncmds);
+void tft_composetile(tft_composer *c, int tile);
+void* thread_tile(void *arg);
+#endif
+void tft_copyrect(UINTPTR from, UINTPTR to, tft_rect *rect);
+void tft_clearframe(UINTPTR frame);
+#if TFT_PALETTE
+void tft_indexrect(UINTPTR from, tft_rect *rect);
+void tft_expandrect(UINTPTR to, tft_rect *rect);
+void tft_expanddamage(UINTPTR to);
+#endif
+void tft_loadscreen(XTft *Tft, UINTPTR from, tft_rect *rects, int count);
+unsigned int tft_present(XTft *Tft);
+void frame_printstats();
+void render_init();
+void render_push(render_cmd *cmd);
+void render_post(int op, int a0, int a1, int a2, int a3, char *text);
+void render_brick(msg_col *col);
+void render_take(render_cmd *cmd);
+void render_run(render_cmd *cmd);
+int render_presentqueued();
+void render_present(render_cmd *cmd);
+void render_screen(XTft *Tft, int cursor, int lengthen);
+void render_snapshot(XTft *Tft);
+void render_printstats();
+
+//mailbox
+void timer_init();
+unsigned int timestamp();
+unsigned int timestamp_diff_us(unsigned int from, unsigned int to);
+void mbox_send(msg_header *header, size_t msgsize, int type, int channel);
+void mbox_send_control(int game_status);
+void mbox_send_event(int event, int arg);
+int mbox_headerok(msg_header *header);
+int mbox_receive(msg_any *msg);
+int mbox_wait(msg_any *msg);
+void mbox_printstats(char *side);
+void hist_add(latency_hist *hist, unsigned int us);
+void hist_print(char *name, latency_hist *hist);
+
+//stage timing
+void stage_add(int stage, unsigned int counts);
+int stage_bucket(unsigned int ns);
+unsigned int stage_bucketmax(int bucket);
+unsigned int stage_percentile(stage_hist *hist, int percent);
+void stage_printstats();
 
 /************************** Variable Definitions ****************************/
 
@@ -260,29 +650,47 @@ void XTft_DrawSolidCircle(XTft *Tft, int x, int y);
 #define MY_CPU_ID XPAR_CPU_ID
 #define MBOX_DEVICE_ID		XPAR_MBOX_0_DEVICE_ID
 static XMbox Mbox;	/* Instance of the Mailbox driver */
+mbox_stats mboxstats;
+stage_hist stages[NUM_STAGES];
+char *stage_names[NUM_STAGES] = {
+	"mbox wait", "update", "collision", "brick send", "state send",
+	"ball draw", "brick draw", "HUD draw", "compose",
+};
+pthread_mutex_t mbox_mutex;	// one sender at a time
+sem_t sem_inbox;			// counts messages queued by thread_mbox on any channel
+
+// timer declaration
+#ifdef XPAR_TMRCTR_0_DEVICE_ID
+#define TIMER_DEVICE_ID XPAR_TMRCTR_0_DEVICE_ID
+#define TIMER_COUNTS_PER_US (XPAR_TMRCTR_0_CLOCK_FREQ_HZ / 1000000)
+XTmrCtr Timer;
+#else
+#define TIMER_COUNTS_PER_US 1	// falls back to xget_clock_ticks, 10ms resolution
+#endif
 
 //HW Mutex
 #define MUTEX_DEVICE_ID XPAR_MUTEX_0_IF_0_DEVICE_ID
 #define MUTEX_NUM 0
+#define PADDLE_MUTEX_NUM 1		// user register holds the paddle word
+#define PADDLE_TIME_MUTEX_NUM 2	// user register holds timestamp() of the input behind the paddle word
 XMutex mutex;
 
 // declare the semaphore
-sem_t sem_red, sem_changeback;
+sem_t sem_levelup;					// posted by thread_game at every level up
 
 // software mutex declaration
 //display
 pthread_mutex_t uart_mutex;
-pthread_mutex_t cursor_mutex;
 pthread_mutex_t tft_mutex;
-pthread_mutex_t brick_mutex;		//protect bricks[]
-pthread_mutex_t red_mutex;			//protect redcol[]
-//pthread_mutex_t gamestate_mutex;	//might be needed [debug]
+pthread_mutex_t reset_mutex;		//held by game_reset while the game is rebuilt, by other threads for one unit of work
+pthread_mutex_t gamestate_mutex;	//protect gameview.state changes and gamestate_waiting[]
+pthread_mutex_t view_mutex;			//one thread writing gameview at a time
 
 
 // threads declaration
 //display threads
-pthread_t tdrawbrick, tgame, tbar, treset;
-pthread_t tcol1, tcol2;
+pthread_t tgame, tbar, tstats, tmbox, trender, tbuttons;
+pthread_t tred;
 
 
 static XTft TftInstance;
@@ -292,21 +700,124 @@ XGpio gpPB; //PB device instance.
 //global variables
 //display
 unsigned int clock_ticks_previrq;
-unsigned int clock_ticks_buttonheld;
-unsigned int redcol[MAXREDCOLUMNS];
-unsigned int redcolprev[MAXREDCOLUMNS];
-unsigned int bricks[TOTAL_COLUMNS];
-signed int cursor_curr;			// absolute position
+unsigned int redcol[MAXREDCOLUMNS];	// red columns 1-10, 0 for none, see red_choose
+unsigned int bricks[TOTAL_COLUMNS];	// written by thread_game, read by thread_red
+unsigned int paddle_seq;			// bumped by every paddle_publish
 signed int redcount;
-unsigned char val_prev;
+game_view gameview;					// see game_view
+unsigned int view_seq;				// odd while gameview is being written
 
-int col_count;
-int gamestateflag;
 int receive_packet_no;
+// last ball position posted to thread_render, written by thread_game except while the ball is held,
+// when only game_moveheldball moves it; the hand over is the state change under gamestate_mutex
 int ball_drawn_x;
 int ball_drawn_y;
 int crystalbrick[NUM_CRYSTAL_BRICK];
-int poweruplengthen;
+unsigned int crystalcols[TOTAL_COLUMNS];	// bit row-1 set for a crystal brick, same bricks as crystalbrick[]
+
+//game state
+int gamestate_waiting[GAME_WAITERS];	// the waiter is blocked in game_wait, sem_gamestate is posted at the next change
+sem_t sem_gamestate[GAME_WAITERS];
+sem_t sem_buttons;						// counts presses queued by gpPBIntHandler
+unsigned char button_val[BUTTON_RING];
+unsigned int button_time[BUTTON_RING];	// timestamp() of the press
+volatile unsigned int button_head;		// written by gpPBIntHandler only
+volatile unsigned int button_tail;		// written by thread_buttons only
+
+//reset
+unsigned int reset_generation;		// bumped by every reset
+unsigned int reset_press_time;		// timestamp() of the reset button press
+
+//red columns, bit column-1 of each mask, the masks are read without a lock
+unsigned int col_alive;				// columns with bricks left, cleared by thread_game
+unsigned int red_mask;				// columns red now, set by thread_red and red_start
+unsigned int red_prev;				// columns red before the last level up, not picked again straight away
+unsigned int red_levelups;			// level ups thread_red has yet to take, a reset drops them
+
+//frames, protected by tft_mutex
+UINTPTR frame_front;				// frame on screen
+UINTPTR frame_back;					// frame drawn into, TftInstance's VideoMemBaseAddr unless TFT_PALETTE
+#if TFT_PALETTE
+u32 tft_palette[TFT_PALETTE_SIZE] = {SPRITE_KEY};	// 0x00RRGGBB of each index, the frames are composed in indices
+int tft_colours = 1;				// entries in use, added by tft_colour
+#endif
+tft_rect damage[MAX_DAMAGE];		// composed into the back frame since the last present
+int damage_count;
+int damage_full;					// damage[] overflowed, the whole screen counts as drawn
+tft_drawcmd drawcmd[MAX_DRAWCMDS];	// recorded since the last compose
+int drawcmd_count;
+tft_rect pending[MAX_DAMAGE];		// merged area of drawcmd[]
+int pending_count;
+int pending_full;
+tft_composer composer;				// thread_render's
+#if TFT_TILE_THREADS > 1
+//tile workers, they compose only while thread_render waits for them in tft_composetiles
+tft_composer tile_composer[TFT_TILE_THREADS];	// [0] unused, thread_render composes its tiles with composer
+pthread_t ttile[TFT_TILE_THREADS];
+sem_t sem_tilework;					// posted once per worker that is to take part
+sem_t sem_tiledone;					// posted by each when no tile is left
+int tile_threads = 1;				// threads composing an area, thread_render included
+int tile_started = 1;				// threads running, thread_render included
+XTft *tile_tft;						// the area being composed, its primitives and tiles
+tft_rect tile_area;
+int *tile_cmds;
+int tile_ncmds;
+int tile_columns;					// tiles across the area
+int tile_count;
+int tile_next;						// next tile to take
+#endif
+frame_stats framestats;
+
+//render ring, any thread posts, only thread_render takes
+render_cmd render_ring[RENDER_RING_SIZE];
+unsigned int render_head;			// next position a producer claims
+unsigned int render_tail;			// next position thread_render takes, only it writes this
+sem_t sem_render;					// counts commands posted and not yet taken
+render_stats renderstats;
+int render_ball_x;					// what thread_render has drawn, it alone uses these
+int render_ball_y;
+int render_cursor;
+int render_lengthen;
+int render_firstframe;				// a merged present was the first frame after a reset
+unsigned int render_resetstart;		// its reset_start_time
+unsigned int render_fpsticks;		// xget_clock_ticks() when the fps box was last drawn
+unsigned int render_fpsframes;		// framestats.presented then
+int render_screenloaded;			// the last render_screen copied the snapshot rather than drawing the screen
+unsigned int render_screentime;		// us it took
+
+//initial screen snapshot, taken by the first render_screen, thread_render only
+int snapshot_valid;
+tft_rect snapshot_rects[MAX_DAMAGE];	// what the snapshot covers on screen
+int snapshot_count;
+hud_field snapshot_hud[HUD_FIELDS];	// hud[] as the snapshot shows it
+
+//boot
+unsigned int boot_start;			// timestamp() when main_prog started
+unsigned int boot_tftinit;			// us Tft_init took
+
+//sprites
+tft_pixel ball_pixels[(2*CIRCLE_RADIUS+1) * (2*CIRCLE_RADIUS+1)];
+tft_pixel bar_pixels[2*HALFBARLENG * (BAR_BTM-BAR_TOP+1)];
+tft_pixel longbar_pixels[4*HALFBARLENG * (BAR_BTM-BAR_TOP+1)];
+tft_sprite ball_sprite;
+tft_sprite bar_sprite;				// normal bar, left edge at cursor - HALFBARLENG
+tft_sprite longbar_sprite;			// lengthened by the powerup, left edge at cursor - 2*HALFBARLENG
+tft_sprite *sprite_list[NUM_SPRITES];
+tft_pixel brick_pixels[4][(BRICK_LENGTH+1) * (BRICK_HEIGHT+1)];
+tft_sprite brick_tile[4];			// yellow, red, and both with crystal stripes
+tft_rect brick_rect[TOTAL_ROWS][TOTAL_COLUMNS];
+tft_pattern stripe_pattern;			// crystal brick stripes, one pixel in three
+
+//HUD, protected by tft_mutex
+tft_pixel glyph_pixels[HUD_GLYPHS][XTFT_CHAR_WIDTH * XTFT_CHAR_HEIGHT];
+tft_sprite glyph_sprite[HUD_GLYPHS];	// rendered by hud_init with XTft_Write, TEXT_COLOUR on TEXTBOX_COLOUR
+hud_field hud[HUD_FIELDS] = {
+	{{600, 10, 639, 39}, "", 0},
+	{{540, 100, 619, 160}, "", 0},
+	{{535, 240, 629, 269}, "", 0},
+	{{535, 330, 629, 359}, "", 0},
+	{{535, 420, 629, 449}, "", 0},
+};
 
 //
 //	Thread functions
@@ -318,170 +829,197 @@ void* thread_bar()
 	int cursor_drawn = INITIAL_BAR;
 	int poweruplengthen_last = 0;
 	int halfbarlength_local = HALFBARLENG;
+	unsigned int generation = reset_generation;
+	int state;
+	game_view view;
 
 	unsigned int clock_ticks_curr;
 
 	while(1)
 	{
-		//handles win/lose/pause by sleeping
-		while((gamestateflag == GAME_WIN) || (gamestateflag == GAME_LOSE) || (gamestateflag == GAME_PAUSE))
-		{
-			sleep(40);
-		}
-		if(gamestateflag == GAME_RESET)
-		{
-			pthread_mutex_lock(&uart_mutex);
-			xil_printf("Bar thread exiting..\n\n");
-			pthread_mutex_unlock(&uart_mutex);
+		//blocks through win/lose/pause/reset
+		state = game_wait(WAITER_BAR, GAME_MASK(GAME_NORMAL) | GAME_MASK(GAME_BALLHELD));
 
-			pthread_exit(0);
+		pthread_mutex_lock(&reset_mutex);
+		if(generation != reset_generation)
+		{
+			// init_screen has posted a fresh bar
+			generation = reset_generation;
+			cursor_drawn = INITIAL_BAR;
+			poweruplengthen_last = 0;
+			halfbarlength_local = HALFBARLENG;
 		}
 
-		if (val_prev == BTN_LEFT || val_prev == BTN_RIGHT )	// button is being held
+		view_read(&view);
+		if (view.buttons == BTN_LEFT || view.buttons == BTN_RIGHT )	// button is being held
 		{
 			clock_ticks_curr = xget_clock_ticks();
 
-			if(clock_ticks_curr - clock_ticks_buttonheld >25)	//held for more than 250 ms
+			if(clock_ticks_curr - view.held_since >25)	//held for more than 250 ms
 			{
 				//move bar quickly
 				//200px per sec @ 25fps
 				//8px per 1/25 sec @ 1 frame per 1/25 sec
 				//1/25 sec = 40ms
 
-				if(val_prev == BTN_LEFT)
+				view_lock();
+				if(gameview.buttons == BTN_LEFT)
 				{
-					pthread_mutex_lock (&cursor_mutex);	//[debug] to check if endcase are set correctly
-					cursor_curr = cursor_curr - 8;
-					if (cursor_curr < CURSOR_LEFTX + halfbarlength_local )
-					cursor_curr = CURSOR_LEFTX + halfbarlength_local ;		// set to leftmost possible position
-					pthread_mutex_unlock (&cursor_mutex);
-
+					cursor_temp = gameview.cursor - 8;
+					if (cursor_temp < CURSOR_LEFTX + halfbarlength_local )
+					cursor_temp = CURSOR_LEFTX + halfbarlength_local ;		// set to leftmost possible position
+					paddle_publish(cursor_temp);
 				}
-				else if (val_prev == BTN_RIGHT)
+				else if (gameview.buttons == BTN_RIGHT)
 				{
-					pthread_mutex_lock (&cursor_mutex);
-					cursor_curr = cursor_curr + 8;
-					if (cursor_curr > CURSOR_RIGHTX - halfbarlength_local)
-					cursor_curr = CURSOR_RIGHTX - halfbarlength_local; 	//set to rightmost possible location
-					pthread_mutex_unlock (&cursor_mutex);
+					cursor_temp = gameview.cursor + 8;
+					if (cursor_temp > CURSOR_RIGHTX - halfbarlength_local)
+					cursor_temp = CURSOR_RIGHTX - halfbarlength_local; 	//set to rightmost possible location
+					paddle_publish(cursor_temp);
 				}
+				view_unlock();
+				view_read(&view);
 			}
 
 		}
-		pthread_mutex_lock (&cursor_mutex);
-		cursor_temp = cursor_curr;
-		pthread_mutex_unlock (&cursor_mutex);
+		cursor_temp = view.cursor;
 
-		// redraw bar if bar is outdated
-		if ((cursor_temp != cursor_drawn) || (poweruplengthen_last != poweruplengthen))
+		// redraw bar if bar is outdated, cursor_drawn is the last position posted to thread_render
+		if ((cursor_temp != cursor_drawn) || (poweruplengthen_last != view.lengthen))
 		{
-			if (poweruplengthen == 1)
+			if (view.lengthen == 1)
 				halfbarlength_local  = HALFBARLENG + HALFBARLENG;
 			else
 				halfbarlength_local  = HALFBARLENG;
 
-			pthread_mutex_lock (&cursor_mutex);
-			if (cursor_curr < CURSOR_LEFTX + halfbarlength_local )
-				cursor_curr = CURSOR_LEFTX + halfbarlength_local ;	// set to leftmost possible position
-			else if (cursor_curr > CURSOR_RIGHTX - halfbarlength_local)
-				cursor_curr = CURSOR_RIGHTX - halfbarlength_local; 	//set to rightmost possible location
-			cursor_temp = cursor_curr;
-			pthread_mutex_unlock (&cursor_mutex);
+			// a longer bar may no longer fit where it is
+			if (cursor_temp < CURSOR_LEFTX + halfbarlength_local || cursor_temp > CURSOR_RIGHTX - halfbarlength_local)
+			{
+				view_lock();
+				cursor_temp = gameview.cursor;
+				if (cursor_temp < CURSOR_LEFTX + halfbarlength_local )
+					cursor_temp = CURSOR_LEFTX + halfbarlength_local ;	// set to leftmost possible position
+				else if (cursor_temp > CURSOR_RIGHTX - halfbarlength_local)
+					cursor_temp = CURSOR_RIGHTX - halfbarlength_local; 	//set to rightmost possible location
+				if (cursor_temp != gameview.cursor)
+					paddle_publish(cursor_temp);
+				view_unlock();
+			}
 
 
-			if(gamestateflag == GAME_BALLHELD) //also draw the ball
+			if(state == GAME_BALLHELD) //also draw the ball
 			{
-				drawBall(&TftInstance, ball_drawn_x + cursor_temp - cursor_drawn, ball_drawn_y, &ball_drawn_x, &ball_drawn_y);
+				game_moveheldball(cursor_temp - cursor_drawn);
 			}
 
-			// send new cursor position to ball thread	[debug]
-			drawBar(&TftInstance, cursor_temp, &cursor_drawn, poweruplengthen_last);
-			poweruplengthen_last = poweruplengthen;
+			poweruplengthen_last = view.lengthen;
+			render_post(RENDER_BAR, cursor_temp, poweruplengthen_last, 0, 0, NULL);
+			cursor_drawn = cursor_temp;
 
+			// no game update presents it while the ball is held
+			if(state == GAME_BALLHELD)
+			{
+				render_post(RENDER_PRESENT, 0, 0, 0, 0, NULL);
+			}
 		}
+		pthread_mutex_unlock(&reset_mutex);
 
 		sleep(40); //to update bar every 40ms while being held
 	}
 }
 
-void* thread_drawbrick()
+// the only thread that draws, runs the commands the others post to the render ring in order
+// producers never wait on tft_mutex or the compose, only on a full ring
+// with DOUBLE_BUFFER frames are paced by the vsync, tft_present waits for the TFT to latch one
+// before the next is drawn, so at most one is shown per refresh; single buffered nothing waits
+// for it and a frame is on screen as soon as it is composed
+// either way a frame that has a later one posted behind it is not presented on its own but with that one
+void* thread_render()
 {
-	msg_col msg_recd;
-	int drawbrick_timestamp = xget_clock_ticks();
-	int drawbrick_timestamp2;
-	int drawbrick_timeinterval;
+	render_cmd cmd;
 
 	while (1)
 	{
-		// read msg from msgqueue and update that column
-		receive(DRAWBRICK_Q, &msg_recd, sizeof(msg_col));
-		//does not need to handle win/lose/pause/ballheld as will be blocked at blocking receive
-
-
-		if(gamestateflag == GAME_RESET)
+		sem_wait(&sem_render);
+		render_take(&cmd);
+		if (cmd.op == RENDER_PRESENT)
 		{
-			pthread_mutex_lock(&uart_mutex);
-			xil_printf("drawbrick thread exiting..\n\n");
-			pthread_mutex_unlock(&uart_mutex);
-			pthread_exit(0);
+			if (cmd.arg[0] == 1)
+			{
+				render_firstframe = 1;
+				render_resetstart = cmd.arg[1];
+			}
+			if (render_presentqueued())
+			{
+				framestats.merged++;
+				continue;
+			}
+			render_run(&cmd);
+			continue;
 		}
-		drawbrick_timestamp2 = xget_clock_ticks();
-		drawbrick_timeinterval = drawbrick_timestamp2 - drawbrick_timestamp;
-		drawbrick_timestamp = xget_clock_ticks();
-
-		//pthread_mutex_lock(&uart_mutex);
-		//xil_printf("Draw brick thread invoked after %d * 10 milliseconds since previous invocation\n\n", drawbrick_timeinterval);
-		//pthread_mutex_unlock(&uart_mutex);
-
-		//draw Column - //msg_recd.id ranges from 1-10
-		drawBCol(&TftInstance, msg_recd.id, msg_recd.status, msg_recd.isRed);
-
-		//pthread_mutex_lock(&uart_mutex);
-		//xil_printf(" \nCol: %d drawn with status: %x isRed = %d \n", msg_recd.id, msg_recd.status, msg_recd.isRed);
-		//pthread_mutex_unlock(&uart_mutex);
+		tft_begin();
+		render_run(&cmd);
+		tft_end();
 	}
 }
+
 void* thread_game(void)
 {
 	int i,k;
-	int score_nextlevel = 10;
-	int ballspeed_shown = INITIAL_BALLSPEED;
+	int score_nextlevel;
+	int ballspeed_shown;
 	int brickrow = 0;
 	int brickcol = 0;
 	int tempmask = 0xFF;
-	int game_score = 0;
-	int game_brickleft = TOTAL_ROWS *  TOTAL_COLUMNS;
-	int shown_score = 0;
-	int shown_brickleft = TOTAL_ROWS * TOTAL_COLUMNS;
-	int firstrun = 1;
-	int poweruphold = 0;
+	int game_score;
+	int game_brickleft;
+	int shown_score;
+	int shown_brickleft;
+	int firstrun;
+	int poweruphold;
+	int newgame = 1;
+	int firstframe_pending = 0;
 
 	unsigned int lastupdated_time = xget_clock_ticks();
 	unsigned int curr_time = xget_clock_ticks();
-	unsigned int shown_time = 0;
-	unsigned int game_time = 0;
+	unsigned int shown_time;
+	unsigned int game_time;
 	unsigned int poweruphold_timer = xget_clock_ticks();
 	unsigned int poweruplengthen_timer = xget_clock_ticks();
+	unsigned int reset_start_time = 0;
 
 	msg_col msg_temp;
 	msg_temp.id = 1;
 	msg_temp.status = 0xFF;
 	msg_temp.isRed = 0;
+	msg_temp.row = 0;
 
 	msg_ball msg_ball_recd;
 	msg_game msg_game_tosend;
+	msg_any msg_recd;
 
-	int gamethread_timestamp = xget_clock_ticks();
-	int gamethread_timestamp2;
-	int gamethread_timeinterval;
-	int gamethread_finishtimestamp;
-	int gamethread_finishinterval;
-	int fps_prev = xget_clock_ticks();
-	int frame_count = 0;
+	unsigned int stage_start, update_start, collision_start;
+	game_view view;
 
 
 	while(1)
 	{
+		// start of a game, again after every reset
+		if(newgame == 1)
+		{
+			score_nextlevel = 10;
+			ballspeed_shown = INITIAL_BALLSPEED;
+			game_score = 0;
+			game_brickleft = TOTAL_ROWS * TOTAL_COLUMNS;
+			shown_score = 0;
+			shown_brickleft = TOTAL_ROWS * TOTAL_COLUMNS;
+			shown_time = 0;
+			game_time = 0;
+			poweruphold = 0;
+			firstrun = 1;
+			newgame = 0;
+		}
+
 		// use mailbox etc to be notified of collision
 		// receives info on ballx, bally, ballspeed, brickrow, brickcol
 		// brickrow is 1-8 or BOTTOM_HIT or BAR_HIT
@@ -489,91 +1027,88 @@ void* thread_game(void)
 
 
 		// could be GAME_WIN, GAME_PAUSE, GAME_RESET, GAME_NORMAL
-		XMbox_ReadBlocking(&Mbox, &msg_ball_recd, sizeof(msg_ball));
-		//XMutex_Lock(&mutex, MUTEX_NUM);
-		//xil_printf("-- Sucessfully received IN RECEIVER --\r\n");
-		//XMutex_Unlock(&mutex, MUTEX_NUM);
-
-		//debug
-		if (msg_ball_recd.message_for == MESSAGE_FOR_BALL)
-		{
-			XMutex_Lock(&mutex, MUTEX_NUM);
-			xil_printf("-- Error - GAME received message meant for BALL!! --\r\n");
-			XMutex_Unlock(&mutex, MUTEX_NUM);
-			while(1); //stall here
-		}
+		// ball only sends state, anything else is dropped
+		STAGE_BEGIN(stage_start);
+		while(mbox_wait(&msg_recd) != CHANNEL_STATE);
+		msg_ball_recd = msg_recd.ball;
+		STAGE_END(STAGE_MBOXWAIT, stage_start);
+		STAGE_BEGIN(update_start);
 
 		//process the received msg
 		//GAME_LOSE
-		if (msg_ball_recd.brickrow == BOTTOM_HIT)
+		//a reset pressed just before is kept, it is picked up below
+		if (msg_ball_recd.brickrow == BOTTOM_HIT && game_transition(GAME_MASK(GAME_NORMAL) | GAME_MASK(GAME_PAUSE), GAME_LOSE))
 		{
-			gamestateflag = GAME_LOSE;
-			XTft_DrawTextBox(&TftInstance, 305, 230, 364, 249, "LOSE!!!");
+			render_post(RENDER_TEXT, 305, 230, 364, 249, "LOSE!!!");
+			render_post(RENDER_PRESENT, 0, 0, 0, 0, NULL);
 			//breaks only when player resets
-			while(gamestateflag == GAME_LOSE)
-			{
-				sleep(40);
-			}
+			game_wait(WAITER_GAME, ~GAME_MASK(GAME_LOSE));
 		}
 
 		// GAME_PAUSE
-		if(gamestateflag == GAME_PAUSE)
+		view_read(&view);
+		if(view.state == GAME_PAUSE)
 		{
-			XTft_DrawTextBox(&TftInstance, 315, 230, 379, 249, "<PAUSE>");
+			render_post(RENDER_TEXT, 315, 230, 379, 249, "<PAUSE>");
+			render_post(RENDER_PRESENT, 0, 0, 0, 0, NULL);
+			mbox_send_control(GAME_PAUSE);
 
 			// updates game_time at point of pause
 			curr_time = xget_clock_ticks();
 			game_time = game_time + curr_time - lastupdated_time;
 
-			while(gamestateflag == GAME_PAUSE)
+			view.state = game_wait(WAITER_GAME, ~GAME_MASK(GAME_PAUSE));
+			if (view.state == GAME_NORMAL)
 			{
-				sleep(40);
+				mbox_send_control(GAME_NORMAL);	// a reset is announced by game_reset instead
 			}
-
-
-			XTft_DrawSolidBox(&TftInstance, 315, 230, 379, 249, GAMEAREA_COLOUR);
-			//msg_game_tosend.game_status = gamestateflag;
-			//XMbox_WriteBlocking(&Mbox, &msg_game_tosend, sizeof(msg_game));
+			render_post(RENDER_RESTORE, 315, 230, 379, 249, NULL);
 
 			curr_time = xget_clock_ticks();
 			lastupdated_time = curr_time;
+			STAGE_BEGIN(update_start);
 		}
 		//cannot be at GAME_WIN as has been handled
 
 		//GAME_RESET
-		if(gamestateflag == GAME_RESET)
+		if(view.state == GAME_RESET)
 		{
-			resetHandler();
-			// add in non-blocking receive to clear game_Q
-			pthread_mutex_lock(&uart_mutex);
-			xil_printf("game thread exiting..\n\n");
-			pthread_mutex_unlock(&uart_mutex);
-			pthread_exit(0);
+			reset_start_time = timestamp();
+			game_reset();
+			firstframe_pending = 1;
+			newgame = 1;
+			continue;
 		}
 
 
 		// GAME_BALLHELD
-		if(msg_ball_recd.brickrow == BAR_HIT && poweruphold == 1) //barcollision occured
+		if(msg_ball_recd.brickrow == BAR_HIT && poweruphold == 1)
+		{
+			//draws ball with latest bar collided coordinates, before thread_bar can move it
+			ball_drawn_x = msg_ball_recd.ballx;
+			ball_drawn_y = msg_ball_recd.bally;
+			render_post(RENDER_BALL, ball_drawn_x, ball_drawn_y, 0, 0, NULL);
+		}
+		// a press that paused or reset the game since it was looked at above wins over holding the ball
+		if(msg_ball_recd.brickrow == BAR_HIT && poweruphold == 1 && //barcollision occured
+			game_transition(GAME_MASK(GAME_NORMAL), GAME_BALLHELD))
 		{
-			gamestateflag = GAME_BALLHELD;
-			XTft_DrawTextBox(&TftInstance, 315, 230, 399, 249, "<BALLHELD>");
+			render_post(RENDER_TEXT, 315, 230, 399, 249, "<BALLHELD>");
+			mbox_send_control(GAME_BALLHELD);
 
 			// updates game_time at point of pause
 			//curr_time = xget_clock_ticks();
 			//game_time = game_time + curr_time - lastupdated_time;
 
-			//draws ball with latest bar collided coordinates
-			drawBall(&TftInstance, msg_ball_recd.ballx, msg_ball_recd.bally, &ball_drawn_x, &ball_drawn_y);
-
+			render_post(RENDER_PRESENT, 0, 0, 0, 0, NULL);
 
-			//can only break out of loop if gamestateflag change to GAME_NORMAL
-			while(gamestateflag == GAME_BALLHELD)
-			{
-				sleep(40);
-			}
+			//thread_bar moves the ball with the bar, can only carry on once the state changes to GAME_NORMAL
+			game_wait(WAITER_GAME, GAME_MASK(GAME_NORMAL));
+			STAGE_BEGIN(update_start);
 
 
-			XTft_DrawSolidBox(&TftInstance, 315, 230, 399, 249, GAMEAREA_COLOUR);
+			render_post(RENDER_RESTORE, 315, 230, 399, 249, NULL);
+			mbox_send_control(GAME_NORMAL);
 
 			//curr_time = xget_clock_ticks();
 			//lastupdated_time = curr_time;
@@ -594,37 +1129,29 @@ void* thread_game(void)
 		// start of brick collision handling
 		if (msg_ball_recd.brickrow != 0 && msg_ball_recd.brickrow <= TOTAL_ROWS)
 		{
+			STAGE_BEGIN(collision_start);
 			brickrow = msg_ball_recd.brickrow;
 			brickcol = msg_ball_recd.brickcol;
 			msg_temp.id = brickcol;	//ranges from 1-10
+			msg_temp.row = brickrow;	//only the brick hit is redrawn
+			msg_temp.generation = reset_generation;
 			tempmask = generatebitmask(brickrow);
 
-			msg_temp.isRed = 0;	//assume column is not red first
-			pthread_mutex_lock(&red_mutex);
-			for(i = 0; i < MAXREDCOLUMNS; i++)
-			{
-				//check if the collided column is red
-				if(redcol[i] == brickcol)
-				{
-					msg_temp.isRed = 1;
-					break;
-				}
-			}
-			pthread_mutex_unlock(&red_mutex);
+			//check if the collided column is red
+			msg_temp.isRed = (__atomic_load_n(&red_mask, __ATOMIC_ACQUIRE) >> (brickcol-1)) & 1;
 
 			// update bricks[]
-			pthread_mutex_lock(&brick_mutex);
-			bricks[brickcol-1]	= tempmask & bricks[brickcol-1];
-			msg_temp.status  = bricks[brickcol-1];
-			pthread_mutex_unlock(&brick_mutex);
+			msg_temp.status = tempmask & bricks[brickcol-1];
+			__atomic_store_n(&bricks[brickcol-1], msg_temp.status, __ATOMIC_RELAXED);
 
 
 			if (msg_temp.status == 0)
-			col_count--;
+			__atomic_fetch_and(&col_alive, ~(1u << (brickcol-1)), __ATOMIC_RELAXED);
 
-			// use msgq to redraw bricks
-			//have to consider if brick disappear at the instant of the collision
-			send(DRAWBRICK_Q, &msg_temp, sizeof(msg_col));
+			// post the brick to be redrawn
+			STAGE_BEGIN(stage_start);
+			render_brick(&msg_temp);
+			STAGE_END(STAGE_BRICKSEND, stage_start);
 
 			//update brickleft
 			game_brickleft--;
@@ -638,7 +1165,9 @@ void* thread_game(void)
 				{
 					poweruphold = 1;
 					poweruphold_timer = xget_clock_ticks();
-					poweruplengthen = 1;
+					view_lock();
+					gameview.lengthen = 1;
+					view_unlock();
 					poweruplengthen_timer = xget_clock_ticks();
 
 					pthread_mutex_lock(&uart_mutex);
@@ -668,34 +1197,36 @@ void* thread_game(void)
 				//pthread_mutex_lock(&uart_mutex);
 				//xil_printf(" Columns about to change back \n");
 				//pthread_mutex_unlock(&uart_mutex);
-				sem_post(&sem_changeback);
-				sem_post(&sem_changeback);
+				__atomic_fetch_add(&red_levelups, 1, __ATOMIC_RELAXED);
+				sem_post(&sem_levelup);
 
 				// ball speed will be increased by ball thread after next mailbox msg
 				// since updated by ball, will not update screen immediately
 
 			}
 
+			STAGE_END(STAGE_COLLISION, collision_start);
+
 			//GAME_WIN
 			if(game_brickleft == 0)
 			{
-				gamestateflag = GAME_WIN;
-				XTft_DrawTextBox(&TftInstance, 315, 230, 369, 249, "WIN!!!");
-
-				//breaks only when player resets
-				while(gamestateflag == GAME_WIN)
+				//already GAME_RESET if the player reset just before
+				if (game_transition(GAME_MASK(GAME_NORMAL) | GAME_MASK(GAME_PAUSE), GAME_WIN))
 				{
-					sleep(40);
+					render_post(RENDER_TEXT, 315, 230, 369, 249, "WIN!!!");
+					render_post(RENDER_PRESENT, 0, 0, 0, 0, NULL);
+					mbox_send_control(GAME_WIN);
+
+					//breaks only when player resets
+					game_wait(WAITER_GAME, GAME_MASK(GAME_RESET));
 				}
-				//when it exits, gamestateflag == GAME_RESET
 
 				//GAME_RESET
-				resetHandler();
-				// add in non-blocking receive to clear game_Q
-				pthread_mutex_lock(&uart_mutex);
-				xil_printf("game thread exiting..\n\n");
-				pthread_mutex_unlock(&uart_mutex);
-				pthread_exit(0);
+				reset_start_time = timestamp();
+				game_reset();
+				firstframe_pending = 1;
+				newgame = 1;
+				continue;
 
 			}
 
@@ -709,64 +1240,57 @@ void* thread_game(void)
 			}
 		}
 
-		if(poweruplengthen == 1)
+		view_read(&view);
+		if(view.lengthen == 1)
 		{
 			if(xget_clock_ticks() - poweruplengthen_timer > 1500)
 			{
-				poweruplengthen = 0;	//will off powerflag after 5000ms
+				view_lock();
+				gameview.lengthen = 0;	//will off powerflag after 5000ms
+				view_unlock();
+				view.lengthen = 0;
 			}
 		}
 
 
 
 		//send message
-		msg_game_tosend.message_for = MESSAGE_FOR_BALL;
-		pthread_mutex_lock (&cursor_mutex);
-		msg_game_tosend.bar_position = cursor_curr;
-		pthread_mutex_unlock (&cursor_mutex);
+		msg_game_tosend.bar_position = view.cursor;
+		msg_game_tosend.bar_time = view.input_time;
 		msg_game_tosend.score = game_score;
-		msg_game_tosend.game_status = gamestateflag;
 		//ensuring message sizes to and fro game and ball applications are similar in size
 		msg_game_tosend.poweruphold = poweruphold;
-		msg_game_tosend.poweruplengthen = poweruplengthen;
+		msg_game_tosend.poweruplengthen = view.lengthen;
 		msg_game_tosend.ballheldx = ball_drawn_x;
 
 		//send(GAME_Q, &msg_ball_tosend, sizeof(msg_ball));	//debug - can delete
 
-		XMbox_WriteBlocking(&Mbox, &msg_game_tosend, sizeof(msg_game));
-		//XMutex_Lock(&mutex, MUTEX_NUM);
-		//xil_printf("-- Sucessfully send from GAME to BALL --\r\n");
-		//XMutex_Unlock(&mutex, MUTEX_NUM);
+		STAGE_BEGIN(stage_start);
+		mbox_send(&msg_game_tosend.header, sizeof(msg_game), MSG_TYPE_GAME, CHANNEL_STATE);
+		STAGE_END(STAGE_STATESEND, stage_start);
 
-		if ( xget_clock_ticks() - fps_prev> 100)
-		{
-			XTft_DrawNumberBox(&TftInstance, 600, 10, 639, 39, frame_count);
-			fps_prev = xget_clock_ticks();
-			frame_count = 0;
-		}
-		else
-		{
-			frame_count++;
-		}
+		// the frame is posted to thread_render, which draws it and puts it on screen at RENDER_PRESENT
+		// the fps box is drawn by thread_render from the frames it actually presented
 
 		//draw ball
 		if (ball_drawn_x != msg_ball_recd.ballx || ball_drawn_y != msg_ball_recd.bally)
 		{
-			//debug can refactor this function
-			drawBall(&TftInstance, msg_ball_recd.ballx, msg_ball_recd.bally, &ball_drawn_x, &ball_drawn_y);
+			ball_drawn_x = msg_ball_recd.ballx;
+			ball_drawn_y = msg_ball_recd.bally;
+			render_post(RENDER_BALL, ball_drawn_x, ball_drawn_y, 0, 0, NULL);
 		}
 
 		//update score
 		if(shown_score != game_score)
 		{
 			shown_score = game_score;
-			XTft_DrawNumberBox(&TftInstance, 540, 100, 619, 160, shown_score);
+			render_post(RENDER_HUD, HUD_SCORE, shown_score, 0, 0, NULL);
 		}
 		//update speed
 		if(ballspeed_shown != msg_ball_recd.speed)
 		{
 			ballspeed_shown = msg_ball_recd.speed;
-			XTft_DrawNumberBox(&TftInstance, 535, 330, 629, 359, ballspeed_shown);
+			render_post(RENDER_HUD, HUD_SPEED, ballspeed_shown, 0, 0, NULL);
 		}
 		//update time
 		curr_time = xget_clock_ticks();
@@ -775,34 +1299,20 @@ void* thread_game(void)
 		if(game_time/100 != shown_time)
 		{
 			shown_time = game_time/ 100;
-			XTft_DrawNumberBox(&TftInstance, 535, 240, 629, 269, shown_time);
+			render_post(RENDER_HUD, HUD_TIME, shown_time, 0, 0, NULL);
 		}
 
 		//update brickleft
 		if(shown_brickleft != game_brickleft)
 		{
 			shown_brickleft = game_brickleft;
-			XTft_DrawNumberBox(&TftInstance, 535, 420, 629, 449, shown_brickleft);
+			render_post(RENDER_HUD, HUD_BRICKS, shown_brickleft, 0, 0, NULL);
 		}
 
-
-		/*
-		gamethread_timestamp2 = xget_clock_ticks();
-		gamethread_timeinterval = gamethread_timestamp2 - gamethread_timestamp;
-		pthread_mutex_lock(&uart_mutex);
-		xil_printf("new ball displayed receiving packet_no %d, %d * 10 milliseconds after previous update \n\n", receive_packet_no, gamethread_timeinterval);
-		pthread_mutex_unlock(&uart_mutex);
-		gamethread_timestamp = xget_clock_ticks();
-
-		receive_packet_no +=1;
-		*/
-		/*
-		gamethread_finishtimestamp = xget_clock_ticks();
-		gamethread_finishinterval = gamethread_finishtimestamp - gamethread_timestamp;
-		pthread_mutex_lock(&uart_mutex);
-		xil_printf("game thread finishes after %d * 10 milliseconds since current invocation\n\n", gamethread_finishinterval);
-		pthread_mutex_unlock(&uart_mutex);
-		*/
+		// the first frame after a reset has thread_render print how long it took to show
+		render_post(RENDER_PRESENT, firstframe_pending, reset_start_time, 0, 0, NULL);
+		firstframe_pending = 0;
+		STAGE_END(STAGE_UPDATE, update_start);
 
 
 		//sleep(40);   //Try to see if this smoothens out the lag in any way //debug - is this still needed?
@@ -810,108 +1320,73 @@ void* thread_game(void)
 	}
 }
 
-// brick thread suppose to compute if ball hits,
-// but not needed in our implementation
-void* thread_bcol1()
+// sleeps until thread_game levels up, then turns the red columns back and picks new ones
+// launched once in init_threads, red_start picks the first ones of every game
+void* thread_red()
 {
 	while (1)
 	{
-		tryRed2((unsigned int) 0);
-		sleep(40);
+		sem_wait(&sem_levelup);
+
+		//a reset clears the red columns, none is picked while it runs
+		pthread_mutex_lock(&reset_mutex);
+		while (__atomic_load_n(&red_levelups, __ATOMIC_RELAXED) > 0)
+		{
+			__atomic_fetch_sub(&red_levelups, 1, __ATOMIC_RELAXED);
+			red_levelup();
+		}
+		pthread_mutex_unlock(&reset_mutex);
 	}
 }
-void* thread_bcol2()
+
+// polls the uart for the stats key, prints the game side stats and asks ball to print its own
+void* thread_stats()
 {
-	while (1)
+	char key;
+
+	while(1)
 	{
-		tryRed2((unsigned int) 1);
-		sleep(40);
+		if (XUartPs_IsReceiveData(STDIN_BASEADDRESS))
+		{
+			key = XUartPs_RecvByte(STDIN_BASEADDRESS);
+			if (key == STATS_KEY)
+			{
+				mbox_printstats("GAME");
+				frame_printstats();
+				render_printstats();
+				mbox_send_event(EVENT_DUMPSTATS, 0);
+			}
+			else if (key == STAGES_KEY)
+			{
+				stage_printstats();
+			}
+		}
+		sleep(50);
 	}
 }
 
-void* thread_reset()
+// mailbox dispatcher, drains the fifo into one msgqueue per channel
+// launched once in main_prog, keeps running across resets
+void* thread_mbox()
 {
-	//kill off existing threads that don't suicide
-	msg_col msg_temp;
-	msg_temp.id = 1;
-	msg_temp.status = 0xFF;
-	msg_temp.isRed = 0;
-	msg_game msg_game_tosend;
-
-	msg_ball msg_ball_tosend;
-	msg_ball_tosend.ballx = INITIAL_X;
-	msg_ball_tosend.bally = INITIAL_Y;
-	msg_ball_tosend.brickrow = 0;
-	msg_ball_tosend.brickcol = 0;
+	msg_any msg_recd;
+	int channel;
+	int msgid;
 
-	//bcol1 and bcol2 alive if col_count >2
-	if (col_count > 2)
+	while(1)
 	{
-		//by freeing these threads with sem_post, they will be able to suicide
-		sem_post(&sem_changeback);
-		sem_post(&sem_changeback);
-	}
-
-	//by freeing this thread with send, it will be able to suicide
-	send(DRAWBRICK_Q, &msg_temp, sizeof(msg_col));
-
-	//attempts to lock, then unlock all mutex
-	pthread_mutex_trylock(&uart_mutex);
-	pthread_mutex_unlock(&uart_mutex);
-
-	pthread_mutex_trylock(&cursor_mutex);
-	pthread_mutex_unlock(&cursor_mutex);
-
-	pthread_mutex_trylock(&tft_mutex);
-	pthread_mutex_unlock(&tft_mutex);
-
-	pthread_mutex_trylock(&brick_mutex);
-	pthread_mutex_unlock(&brick_mutex);
-
-	pthread_mutex_trylock(&red_mutex);
-	pthread_mutex_unlock(&red_mutex);
-
-	//pthread_mutex_trylock(&gamestate_mutex);
-	//pthread_mutex_unlock(&gamestate_mutex);
-
-	//reset hwmutex debug
-
-	//removed ball mutexes unlocking
-
-	pthread_mutex_lock(&uart_mutex);
-	xil_printf("mutex reset, reset thread sleeping...\n\n");
-	pthread_mutex_unlock(&uart_mutex);
-
-	sleep(400); //buffer time to let other threads die
+		channel = mbox_receive(&msg_recd);
 
-	init_variables();
-	init_screen();
-	init_threads();	// may need to re-init semaphores
-
-	sleep(100); //let threads be launched before resetting the sender
-
-	//mb0 finished resetting
-	//send message to reset mb1 - as mb0 has finished resetting
-
-	pthread_mutex_lock(&uart_mutex);
-	xil_printf("thread reset finished init..\n");
-	xil_printf("sending mail to reset ball\n");
-	pthread_mutex_unlock(&uart_mutex);
-
-	msg_game_tosend.message_for = MESSAGE_FOR_BALL;
-	msg_game_tosend.bar_position = 0;
-	msg_game_tosend.score = 0;
-	msg_game_tosend.game_status = GAME_RESET;
-	msg_game_tosend.poweruphold = 0;
-	msg_game_tosend.poweruplengthen = 0;
-	msg_game_tosend.ballheldx = 0;
-	XMbox_WriteBlocking(&Mbox, &msg_game_tosend, sizeof(msg_game));
-
-	pthread_mutex_lock(&uart_mutex);
-	xil_printf("thread reset about exiting..\n\n");
-	pthread_mutex_unlock(&uart_mutex);
-
-	pthread_exit(0);
+		msgid = msgget(CHANNEL_Q + channel, IPC_CREAT);
+		if (msgsnd(msgid, &msg_recd, sizeof(msg_any), 0) < 0)
+		{
+			XMutex_Lock(&mutex, MUTEX_NUM);
+			xil_printf("-- Error - GAME could not queue message on channel %d --\r\n", channel);
+			XMutex_Unlock(&mutex, MUTEX_NUM);
+			continue;
+		}
+		sem_post(&sem_inbox);
+	}
 }
 
 int main(void) {
@@ -929,6 +1404,7 @@ int main(void) {
 int main_prog(void) { // This thread is statically created (as configured in the kernel configuration) and has priority 0 (This is the highest possible)
 
 	int ret;
+	int i;
 	XStatus Status_TFT;
 	XMutex_Config *mutex_cfg;
 	XMbox_Config *ConfigPtr;
@@ -936,11 +1412,27 @@ int main_prog(void) { // This thread is statically created (as configured in the
 
 	print("-- Entering main_prog() uB0 RECEIVER--\r\n");
 
+	// game owns the timer, ball only reads it, started first so boot can be timed
+	timer_init();
+	boot_start = timestamp();
+
 	// init TFT
 	Status_TFT = Tft_init(TFT_DEVICE_ID);
 	if ( Status_TFT != XST_SUCCESS) {
 		return XST_FAILURE;
 	}
+	boot_tftinit = timestamp_diff_us(boot_start, timestamp());
+
+	// the pushbutton isr queues presses from the moment it is enabled
+	ret = pthread_mutex_init (&gamestate_mutex, NULL);
+	//if (ret != 0)
+	//xil_printf ("-- ERROR (%d) init gamestate_mutex...\r\n", ret);
+	ret = pthread_mutex_init (&view_mutex, NULL);
+	for (i = 0; i < GAME_WAITERS; i++)
+	{
+		sem_init(&sem_gamestate[i], 1, 0);
+	}
+	sem_init(&sem_buttons, 1, 0);
 
 	//xil_printf("Initializing PB\r\n");
 	// Initialise the PB instance
@@ -964,21 +1456,15 @@ int main_prog(void) { // This thread is statically created (as configured in the
 	//if (ret != 0)
 	//xil_printf("-- ERROR (%d) init uart_mutex...\r\n", ret);
 	// initialize Mutex
-	ret = pthread_mutex_init (&cursor_mutex, NULL);
-	//if (ret != 0)
-	//xil_printf ("-- ERROR (%d) init cursor_mutex...\r\n", ret);
 	ret = pthread_mutex_init (&tft_mutex, NULL);
 	//if (ret != 0)
 	//xil_printf ("-- ERROR (%d) init tft_mutex...\r\n", ret);
-	ret = pthread_mutex_init (&brick_mutex, NULL);
-	//if (ret != 0)
-	//xil_printf ("-- ERROR (%d) init brick_mutex...\r\n", ret);
-	ret = pthread_mutex_init (&red_mutex, NULL);
-	//if (ret != 0)
-	//xil_printf ("-- ERROR (%d) init red_mutex...\r\n", ret);
-	//ret = pthread_mutex_init (&gamestate_mutex, NULL);
+#if TFT_TILE_THREADS > 1
+	tft_tilethreads(TFT_TILE_THREADS);
+#endif
+	ret = pthread_mutex_init (&reset_mutex, NULL);
 	//if (ret != 0)
-	//xil_printf ("-- ERROR (%d) init gamestate_mutex...\r\n", ret);
+	//xil_printf ("-- ERROR (%d) init reset_mutex...\r\n", ret);
 
 	//Initialize HW Mutex
 
@@ -1000,56 +1486,58 @@ int main_prog(void) { // This thread is statically created (as configured in the
 		return NULL;
 	}
 
+	pthread_mutex_init(&mbox_mutex, NULL);
+	sem_init(&sem_inbox, 1, 0);
+	render_init();
+
 
 	// initialize the semaphore
-	if( sem_init(&sem_red, 1, 2) < 0 )	// may need to re-init semaphores
-	{
-		//xil_printf("Error while initializing semaphore sem.\r\n");
-	}
-	if( sem_init(&sem_changeback, 1, 0) < 0 )	// may need to re-init semaphores
+	if( sem_init(&sem_levelup, 1, 0) < 0 )
 	{
-		//xil_printf("Error while initializing semaphore sem22.\r\n");
+		//xil_printf("Error while initializing semaphore sem_levelup.\r\n");
 	}
 
 	//xil_printf("--Initialized -- uB0 \r\n");
 
+	sprite_init();
+	hud_init(&TftInstance);
 	init_variables();
 	init_screen();
+	red_start();
 	init_threads();	// may need to re-init semaphores
+
+	// stats, the mailbox dispatcher and the render thread survive resets, so launched once here rather than in init_threads
+	ret = pthread_create(&trender, NULL, (void*) thread_render, NULL);
+	if (ret != 0)
+	{
+		xil_printf("-- ERROR (%d) launching thread_render...\r\n", ret);
+	}
+	ret = pthread_create(&tstats, NULL, (void*) thread_stats, NULL);
+	if (ret != 0)
+	{
+		xil_printf("-- ERROR (%d) launching thread_stats...\r\n", ret);
+	}
+	ret = pthread_create(&tmbox, NULL, (void*) thread_mbox, NULL);
+	if (ret != 0)
+	{
+		xil_printf("-- ERROR (%d) launching thread_mbox...\r\n", ret);
+	}
+	ret = pthread_create(&tbuttons, NULL, (void*) thread_buttons, NULL);
+	if (ret != 0)
+	{
+		xil_printf("-- ERROR (%d) launching thread_buttons...\r\n", ret);
+	}
 	return NULL;
 
 }
 
+// posts the initial game screen, drawn by thread_render from the bar as it is now
 void init_screen()
 {
-	int i;
-	// Draw Initial Game Screen
-	XTft_DrawSolidBox(&TftInstance, GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM, GAMEAREA_COLOUR);
-	// Draw the box labels
-	XTft_DrawTextBox(&TftInstance, 555, 10, 589, 39, "fps");
-	XTft_DrawTextBox(&TftInstance, 555, 60, 599, 79, "SCORE");
-	XTft_DrawTextBox(&TftInstance, 555, 200, 599, 219, "TIME");
-	XTft_DrawTextBox(&TftInstance, 555, 290, 599, 309, "SPEED");
-	XTft_DrawTextBox(&TftInstance, 555, 380, 609, 399, "BRICKS");
-
-	// Draw the initial values
-	XTft_DrawNumberBox(&TftInstance, 600, 10, 639, 39, 0);
-	XTft_DrawNumberBox(&TftInstance, 540, 100, 619, 160, 0);
-	XTft_DrawNumberBox(&TftInstance, 535, 240, 629, 269, 0);
-	XTft_DrawNumberBox(&TftInstance, 535, 330, 629, 359, INITIAL_BALLSPEED);
-	XTft_DrawNumberBox(&TftInstance, 535, 420, 629, 449, 80);
-
-	// Draw bricks
-	for(i=1;i< TOTAL_COLUMNS+1 ;i++)
-	{
-		drawBCol(&TftInstance, i, 0xFF, 0);
-	}
-
-	// Initial ball
-	XTft_DrawSolidCircle(&TftInstance, INITIAL_X, INITIAL_Y);
+	game_view view;
 
-	// Initial bar
-	drawBar(&TftInstance, cursor_curr, &cursor_curr, poweruplengthen);
+	view_read(&view);
+	render_post(RENDER_SCREEN, view.cursor, view.lengthen, 0, 0, NULL);
 
 	pthread_mutex_lock(&uart_mutex);
 	xil_printf(" Finished init_screen.\r\n");
@@ -1061,19 +1549,16 @@ void init_variables()
 
 	//display
 	clock_ticks_previrq = xget_clock_ticks();
-	clock_ticks_buttonheld = xget_clock_ticks();
-	cursor_curr = INITIAL_BAR;		// absolute position
+	view_lock();
+	gameview.held_since = xget_clock_ticks();
+	gameview.buttons = 0;
+	gameview.lengthen = 0;
+	paddle_publish(INITIAL_BAR);
+	view_unlock();
 	redcount = 0;
-	redcol[0]= 0;
-	redcol[1]= 0;
-	redcolprev[0]= 0;
-	redcolprev[1]= 0;
-	val_prev = 0;
-	col_count = TOTAL_COLUMNS;
-	gamestateflag = GAME_NORMAL;
+	__atomic_store_n(&col_alive, (1u << TOTAL_COLUMNS) - 1, __ATOMIC_RELAXED);
 	ball_drawn_x = INITIAL_X;
 	ball_drawn_y = INITIAL_Y;
-	poweruplengthen = 0;
 
 	srand(0); 	//fixed seed for easy debugging [debug]
 	//srand(clock_ticks_previrq);		//random seed
@@ -1105,6 +1590,15 @@ void init_variables()
 		crystalbrick[i] = random_num;
 	}
 
+	for(i=0;i<TOTAL_COLUMNS;i++)
+	{
+		crystalcols[i] = 0;
+	}
+	for(i=0;i< NUM_CRYSTAL_BRICK ;i++)
+	{
+		crystalcols[crystalbrick[i] % TOTAL_COLUMNS] |= 1 << (crystalbrick[i] / TOTAL_COLUMNS);
+	}
+
 	for(i=0;i< NUM_CRYSTAL_BRICK ;i++)
 	{
 		pthread_mutex_lock(&uart_mutex);
@@ -1144,35 +1638,15 @@ void init_threads()
 		xil_printf("thread_game launched with ID %d \r\n", tgame);
 	}
 
-	ret = pthread_create(&tdrawbrick, NULL, (void*) thread_drawbrick, NULL);
-	if (ret != 0)
-	{
-		xil_printf("-- ERROR (%d) launching thread_drawbrick...\r\n", ret);
-	}
-	else
-	{
-		xil_printf("thread_drawbrick launched with ID %d \r\n", tdrawbrick);
-	}
-
-
-	ret = pthread_create(&tcol1, NULL, (void*) thread_bcol1, NULL);
-	if (ret != 0)
-	{
-		xil_printf("-- ERROR (%d) launching thread_bcol1...\r\n", ret);
-	}
-	else
-	{
-		xil_printf("thread_bcol1 launched with ID %d \r\n", tcol1);
-	}
 
-	ret = pthread_create(&tcol2, NULL, (void*) thread_bcol2, NULL);
+	ret = pthread_create(&tred, NULL, (void*) thread_red, NULL);
 	if (ret != 0)
 	{
-		xil_printf("-- ERROR (%d) launching thread_bcol2...\r\n", ret);
+		xil_printf("-- ERROR (%d) launching thread_red...\r\n", ret);
 	}
 	else
 	{
-		xil_printf("thread_bcol2 launched with ID %d \r\n", tcol2);
+		xil_printf("thread_red launched with ID %d \r\n", tred);
 	}
 
 
@@ -1184,6 +1658,9 @@ void init_threads()
 int Tft_init(u32 TftDeviceId)
 {
 	int Status;
+#if TFT_PALETTE
+	int i;
+#endif
 	XTft_Config *TftConfigPtr;
 
 	/*
@@ -1220,12 +1697,27 @@ int Tft_init(u32 TftDeviceId)
 	* a valid Memory Address and clear the screen.
 	*/
 	XTft_SetFrameBaseAddr(&TftInstance, TFT_FRAME_ADDR);
-	XTft_ClearScreen(&TftInstance);
+	XTft_SetColor(&TftInstance, 0, 0);
+	tft_clearframe(TFT_FRAME_ADDR);
 
 	//xil_printf("Finish initializing TFT \r\n");
 
-	XTft_SetColor(&TftInstance, 0, 0);
-	XTft_ClearScreen(&TftInstance);
+	frame_front = TFT_FRAME_ADDR;
+	frame_back = TFT_FRAME_ADDR;
+#if DOUBLE_BUFFER
+	// everything is drawn into the second frame while the first is on screen, see tft_present
+	frame_back = TFT_FRAME_ADDR + TFT_FRAME_SIZE;
+	TftInstance.TftConfig.VideoMemBaseAddr = frame_back;
+	tft_clearframe(frame_back);
+#endif
+#if TFT_PALETTE
+	// composed in indices, only the text is drawn by XTft_Write, into a frame of its own
+	TftInstance.TftConfig.VideoMemBaseAddr = TFT_TEXT_ADDR;
+	for (i = 0; i < DISPLAY_ROWS; i++)
+	{
+		memset((tft_pixel *) TFT_INDEX_ADDR + i * XTFT_DISPLAY_BUFFER_WIDTH, tft_colour(0), DISPLAY_COLUMNS * sizeof(tft_pixel));
+	}
+#endif
 
 	return 0;
 }
@@ -1237,6 +1729,7 @@ static void gpPBIntHandler(void *arg) //Should be very short (in time). In a pra
 	unsigned char val;
 	unsigned int clock_ticks_curr;
 	int halfbarlength_local = HALFBARLENG;
+	int cursor;
 
 	clock_ticks_curr = xget_clock_ticks();
 
@@ -1259,75 +1752,52 @@ static void gpPBIntHandler(void *arg) //Should be very short (in time). In a pra
 	//xil_printf("PB event, val = %d \r\n", val);
 	//pthread_mutex_unlock (&uart_mutex);
 
-	val_prev = val;
+	// no thread is writing gameview while the isr runs, see view_lock
+	view_begin();
+	gameview.buttons = val;
 
 	// if clock_ticks elapsed greater than threshold, we consider it a genuine input
 	// de-bouncing logic
 	if((clock_ticks_curr - clock_ticks_previrq ) > 5)
 	{
-		if(gamestateflag == GAME_NORMAL)
+		if(gameview.state == GAME_NORMAL)
 		{
-			if(poweruplengthen == 1)
+			if(gameview.lengthen == 1)
 				halfbarlength_local = HALFBARLENG + HALFBARLENG;
 			else
 				halfbarlength_local = HALFBARLENG;
 
 			if (val == BTN_LEFT) //left
 			{
-				cursor_curr = cursor_curr - 25;	//[debug] to check if end cases are set correctly
-				if (cursor_curr < CURSOR_LEFTX + halfbarlength_local)
-				cursor_curr = CURSOR_LEFTX + halfbarlength_local;	// set to leftmost possible position
-				clock_ticks_buttonheld = xget_clock_ticks();
+				cursor = gameview.cursor - 25;	//[debug] to check if end cases are set correctly
+				if (cursor < CURSOR_LEFTX + halfbarlength_local)
+				cursor = CURSOR_LEFTX + halfbarlength_local;	// set to leftmost possible position
+				gameview.held_since = xget_clock_ticks();
+				paddle_publish(cursor);
 			}
 			else if (val == BTN_RIGHT) //right
 			{
-				cursor_curr = cursor_curr + 25;
-				if (cursor_curr > CURSOR_RIGHTX - halfbarlength_local)
-				cursor_curr = CURSOR_RIGHTX - halfbarlength_local; 	//set to rightmost possible location
-				clock_ticks_buttonheld = xget_clock_ticks();
-			}
-			else if (val == BTN_CENTER) //centre button
-			{
-				gamestateflag = GAME_PAUSE;	//pause game
-			}
-			else if (val == BTN_TOP) //top button
-			{
-				gamestateflag = GAME_RESET;
+				cursor = gameview.cursor + 25;
+				if (cursor > CURSOR_RIGHTX - halfbarlength_local)
+				cursor = CURSOR_RIGHTX - halfbarlength_local; 	//set to rightmost possible location
+				gameview.held_since = xget_clock_ticks();
+				paddle_publish(cursor);
 			}
-	}
-	else if ((gamestateflag == GAME_LOSE) || (gamestateflag == GAME_WIN))
-	{
-		if (val == BTN_TOP) //top button
-		{
-		gamestateflag = GAME_RESET;
-		}
-	}
-	else if (gamestateflag == GAME_PAUSE)
-	{
-		///debug
-		if (val == BTN_CENTER) //centre button
-		{
-			gamestateflag = GAME_NORMAL;	//resume game
-		}
-		if (val == BTN_TOP) //top button
-		{
-		gamestateflag = GAME_RESET;
 		}
-	}
-	else if (gamestateflag == GAME_BALLHELD)
-	{
-		if (val == BTN_BTM) //btm button
+
+		// the rest can change the game state, which takes gamestate_mutex, so they are left to thread_buttons
+		// a press that finds the ring full is dropped
+		if ((val == BTN_CENTER || val == BTN_TOP || val == BTN_BTM) && button_head - button_tail < BUTTON_RING)
 		{
-		gamestateflag = GAME_NORMAL;
+			button_val[button_head % BUTTON_RING] = val;
+			button_time[button_head % BUTTON_RING] = timestamp();
+			button_head++;
+			sem_post(&sem_buttons);
 		}
-	}
-	//gamestateflag == GAME_RESET
-
-
 
 clock_ticks_previrq = xget_clock_ticks();
 }
-
+	view_end();
 }
 
 void send(int destid, void *msgptr, size_t msgsize) {
@@ -1397,10 +1867,9 @@ void receive(int msgqid, void* msgptr, size_t sizeofmsg)
 //	Drawing Functions
 //
 
-void drawBar(XTft *Tft, int cursor, int* cursor_drawn_ptr, int poweruplengthen_last)
+void drawBar(XTft *Tft, int cursor, int* cursor_drawn_ptr, int poweruplengthen_last, int lengthen)
 {
 	int y1 = BAR_TOP;
-	int y2 = BAR_BTM;
 	int dbllength = HALFBARLENG + HALFBARLENG;
 	/*
 	if (cursor_curr > *cursor_drawn_ptr) 	//bar moved to the right
@@ -1414,74 +1883,38 @@ XTft_DrawSolidBox(Tft, cursor+HALFBARLENG+1, y1, *cursor_drawn_ptr+HALFBARLENG,
 XTft_DrawSolidBox(Tft, cursor-HALFBARLENG, y1, *cursor_drawn_ptr-HALFBARLENG-1, y2, BAR_COLOUR);
 }
 */
-	//erase previous bar
-	if(poweruplengthen_last == 0)
+	tft_sprite *oldbar = &bar_sprite;
+	tft_sprite *newbar = &bar_sprite;
+	int oldleft = *cursor_drawn_ptr-HALFBARLENG;
+	int newleft = cursor-HALFBARLENG;
+
+	//erase previous bar where the new one does not cover it, draw the multicolor bar rendered by sprite_init
+	if(poweruplengthen_last == 1)
 	{
-		XTft_DrawSolidBox(Tft, *cursor_drawn_ptr-HALFBARLENG, y1, *cursor_drawn_ptr+HALFBARLENG-1, y2, GAMEAREA_COLOUR);
+		oldbar = &longbar_sprite;
+		oldleft = *cursor_drawn_ptr-dbllength;
 	}
-	else
+	if(lengthen == 1)
 	{
-		XTft_DrawSolidBox(Tft, *cursor_drawn_ptr-dbllength, y1, *cursor_drawn_ptr+dbllength-1, y2, GAMEAREA_COLOUR);
+		newbar = &longbar_sprite;
+		newleft = cursor-dbllength;
 	}
-
-if(poweruplengthen == 0)
-{
-
-	//draw multicolor bar
-	XTft_DrawSolidBox(Tft, cursor-HALFBARLENG, y1, cursor-HALFBARLENG +9, y2, BAR_A_COLOUR);
-	XTft_DrawSolidBox(Tft, cursor-HALFBARLENG+10, y1, cursor-HALFBARLENG+19, y2, BAR_S_COLOUR);
-	XTft_DrawSolidBox(Tft, cursor-20, y1, cursor+19, y2, BAR_COLOUR);
-	XTft_DrawSolidBox(Tft, cursor+HALFBARLENG-20, y1, cursor+HALFBARLENG-11, y2, BAR_S_COLOUR);
-	XTft_DrawSolidBox(Tft, cursor+HALFBARLENG-10, y1, cursor+HALFBARLENG-1, y2, BAR_A_COLOUR);
-}
-else
-{
-	//draw multicolor bar
-	XTft_DrawSolidBox(Tft, cursor-dbllength, y1, cursor-dbllength +19, y2, BAR_A_COLOUR);
-	XTft_DrawSolidBox(Tft, cursor-dbllength+20, y1, cursor-dbllength+39, y2, BAR_S_COLOUR);
-	XTft_DrawSolidBox(Tft, cursor-40, y1, cursor+39, y2, BAR_COLOUR);
-	XTft_DrawSolidBox(Tft, cursor+dbllength-40, y1, cursor+dbllength-21, y2, BAR_S_COLOUR);
-	XTft_DrawSolidBox(Tft, cursor+dbllength-20, y1, cursor+dbllength-1, y2, BAR_A_COLOUR);
-}
+	tft_movesprite(Tft, oldbar, oldleft, y1, newbar, newleft, y1);
 *cursor_drawn_ptr = cursor;
 //pthread_mutex_lock (&uart_mutex);
 //xil_printf("  Bar updated to cursor value: %d.\n", *cursor_drawn_ptr);
 //pthread_mutex_unlock (&uart_mutex);
 }
 //bcol_id ranges from 1-10
+//only the live bricks are drawn, a brick that is hit is erased by drawBrick
 void drawBCol(XTft *Tft, int bcol_id, int bcol_status, int bcol_isRed)
 {
-	int i, j, k, bricktop, brickleft, bitmask;
-	bricktop = GAMEAREA_TOP + 5;
-	brickleft = GAMEAREA_LEFT + 5 +  ( INTERBRICK_X * (bcol_id - 1) );
+	int i;
 
-	for (i = 0; i<8; i++)
+	for (i = 1; i <= TOTAL_ROWS; i++)
 	{
-		bitmask = 1 << i;	//bitmask for different row
-
-		if (bcol_status & bitmask)	// assert when status bit is true
-		{
-			if (bcol_isRed == 1)
-				XTft_DrawSolidBox(Tft, brickleft, bricktop, brickleft + BRICK_LENGTH, bricktop + BRICK_HEIGHT, BRICK_COLOUR_RED);
-			else
-				XTft_DrawSolidBox(Tft, brickleft, bricktop, brickleft + BRICK_LENGTH, bricktop + BRICK_HEIGHT, BRICK_COLOUR);
-			//if special brick
-			k = (i*TOTAL_COLUMNS) + (bcol_id-1);
-			for(j=0;j<NUM_CRYSTAL_BRICK;j++)
-			{
-				if(k == crystalbrick[j])
-				{
-					//draw special pattern
-					XTft_DrawStripes(Tft, brickleft, bricktop, brickleft + BRICK_LENGTH, bricktop + BRICK_HEIGHT, BRICK_COLOUR_STRIPES);
-					break;
-				}
-			}
-		}
-		else
-		{
-			XTft_DrawSolidBox(Tft, brickleft, bricktop, brickleft + BRICK_LENGTH, bricktop + BRICK_HEIGHT, GAMEAREA_COLOUR);
-		}
-		bricktop = bricktop + INTERBRICK_Y;
+		if (bcol_status & (1 << (i-1)))	// assert when status bit is true
+			drawBrick(Tft, i, bcol_id, 1, bcol_isRed);
 	}
 
 	//pthread_mutex_lock(&uart_mutex);
@@ -1489,118 +1922,117 @@ void drawBCol(XTft *Tft, int bcol_id, int bcol_status, int bcol_isRed)
 	//pthread_mutex_unlock(&uart_mutex);
 }
 
-void tryRed2(unsigned int redID) {
-
-	int columnid = rand()%10 + 1;
-	int otherred = (redID + 1) %2;
-	int acceptflag = 0;
-
-	msg_col msg_temp;
-
-	sem_wait(&sem_red);
+//row ranges from 1-8, col from 1-10
+//the brick is drawn into the background layer from the tiles rendered by sprite_init and copied to the screen from there
+void drawBrick(XTft *Tft, int row, int col, int alive, int isRed)
+{
+	tft_rect *rect = &brick_rect[row-1][col-1];
+	int tile = 0;
 
-	while(acceptflag==0)
+	if (alive)
 	{
-
-		while( (columnid == redcolprev[0]) || (columnid == redcolprev[1]) || (columnid == redcol[otherred]) )
-		{
-			columnid = rand()%10 + 1;
-		}
-		pthread_mutex_lock(&brick_mutex);
-		if(bricks[columnid-1]!=0)	//check this column is not empty
-		{
-			acceptflag =1;
-		}
-		else
-		{
-			columnid = rand()%10 + 1;
-		}
-		pthread_mutex_unlock(&brick_mutex);
+		if (isRed == 1)
+			tile |= BRICK_TILE_RED;
+		if (crystalcols[col-1] & (1 << (row-1)))
+			tile |= BRICK_TILE_CRYSTAL;
+		tft_bgtile(&brick_tile[tile], rect->x1, rect->y1);
 	}
+	else
+	{
+		tft_bgbox(rect->x1, rect->y1, rect->x2, rect->y2, GAMEAREA_COLOUR);
+	}
+	tft_restore(Tft, rect->x1, rect->y1, rect->x2, rect->y2);
+}
 
-	//Changing Red
-	pthread_mutex_lock (&red_mutex);
-	redcol[redID] = columnid;
-	pthread_mutex_unlock (&red_mutex);
-
-	msg_temp.id = columnid;
-	msg_temp.isRed = 1;
-	pthread_mutex_lock(&brick_mutex);
-	msg_temp.status = bricks[columnid-1];
-	pthread_mutex_unlock(&brick_mutex);
-
-	send(DRAWBRICK_Q, &msg_temp, sizeof(msg_col));
+// the first red columns of a game, run before any other thread or by game_reset under reset_mutex
+void red_start()
+{
+	int i;
 
-	//pthread_mutex_lock (&uart_mutex);
-	//xil_printf ("  Column %d turned Red!!\n", columnid);
-	//pthread_mutex_unlock (&uart_mutex);
+	for (i = 0; i < MAXREDCOLUMNS; i++)
+	{
+		redcol[i] = 0;
+	}
+	red_prev = 0;
+	__atomic_store_n(&red_mask, 0, __ATOMIC_RELEASE);
+	red_choose();
+}
 
-	sem_wait(&sem_changeback);	//stall till the next time to change colour
+// turns the red columns back and picks new ones, run by thread_red under reset_mutex
+// with 2 or fewer columns of bricks left they stay as they are until the next game
+void red_levelup()
+{
+	int i;
 
-	//for win/lose/reset/ballheld, thread will be block at this sem_wait
+	if (__builtin_popcount(__atomic_load_n(&col_alive, __ATOMIC_RELAXED)) <= 2)
+		return;
 
-	if(gamestateflag == GAME_RESET)
+	red_prev = red_mask;
+	__atomic_store_n(&red_mask, 0, __ATOMIC_RELEASE);
+	for (i = 0; i < MAXREDCOLUMNS; i++)
 	{
-		sem_post(&sem_red);
-		pthread_mutex_lock(&uart_mutex);
-		xil_printf("bcol %d exiting..\n\n", redID);
-		pthread_mutex_unlock(&uart_mutex);
-		pthread_exit(0);
+		if (redcol[i] != 0)
+		{
+			red_post(redcol[i], 0);
+			redcol[i] = 0;
+		}
 	}
+	red_choose();
+}
+
+// picks each red column from those with bricks left that are neither red nor were just before
+// a slot stays empty when no column is left to pick
+void red_choose()
+{
+	unsigned int eligible;
+	int i;
 
-	//stop changing the colors if there are 2 or fewer columns of bricks left
-	//or kill thread if game needs to be reset
-	if(col_count <= 2)
+	for (i = 0; i < MAXREDCOLUMNS; i++)
 	{
-		sem_post(&sem_red);
-		pthread_exit(0);
+		eligible = __atomic_load_n(&col_alive, __ATOMIC_RELAXED) & ~red_prev & ~red_mask;
+		redcol[i] = red_pick(eligible);
+		if (redcol[i] != 0)
+		{
+			__atomic_store_n(&red_mask, red_mask | (1u << (redcol[i] - 1)), __ATOMIC_RELEASE);
+			red_post(redcol[i], 1);
+		}
 	}
-	else
-	{
-		//Changing Back
-		pthread_mutex_lock (&red_mutex);
-		redcol[redID] = 0;		//clear the value
-		redcolprev[redID] = columnid;
-		pthread_mutex_unlock (&red_mutex);
-
-		msg_temp.isRed = 0;
-		pthread_mutex_lock(&brick_mutex);
-		msg_temp.status = bricks[columnid-1];
-		pthread_mutex_unlock(&brick_mutex);
+}
 
-		send(DRAWBRICK_Q, &msg_temp, sizeof(msg_col));
+// a column 1-10 picked uniformly from the bits set in eligible with one rand(), 0 if none is set
+int red_pick(unsigned int eligible)
+{
+	int count = __builtin_popcount(eligible);
+	int skip;
 
-		//pthread_mutex_lock (&uart_mutex);
-		//xil_printf ("  Column %d turn back to Original Colour !!\n", columnid);
-		//pthread_mutex_unlock (&uart_mutex);
-		sem_post(&sem_red);
+	if (count == 0)
+		return 0;
+	skip = rand() % count;
+	while (skip-- > 0)
+	{
+		eligible &= eligible - 1;	// drops the lowest set bit
 	}
+	return __builtin_ctz(eligible) + 1;
+}
 
+// redraws the live bricks of a column red or plain
+void red_post(int column, int isRed)
+{
+	msg_col msg_temp;
 
+	msg_temp.id = column;
+	msg_temp.row = 0;
+	msg_temp.isRed = isRed;
+	msg_temp.status = __atomic_load_n(&bricks[column-1], __ATOMIC_RELAXED);
+	msg_temp.generation = reset_generation;
+	render_brick(&msg_temp);
 }
 
 void drawBall(XTft *Tft, int x, int y, int* ball_ptr_x, int* ball_ptr_y)
 {
-	int x1 = *ball_ptr_x - CIRCLE_RADIUS;
-	int x2 = *ball_ptr_x + CIRCLE_RADIUS;
-	int y1 = *ball_ptr_y - CIRCLE_RADIUS;
-	int y2 = *ball_ptr_y + CIRCLE_RADIUS;
-
-	//trim off the parts that is out of gamearea
-	if (x1 < GAMEAREA_LEFT)
-	x1 = GAMEAREA_LEFT;
-	if (x2 > GAMEAREA_RIGHT)
-	x2 = GAMEAREA_RIGHT;
-	if (y1 < GAMEAREA_TOP)
-	y1 = GAMEAREA_TOP;
-	if (y2 > GAMEAREA_BTM)
-	y2 = GAMEAREA_BTM;
-
-	//Erase previous ball
-	XTft_DrawSolidBox(Tft, x1, y1, x2, y2, GAMEAREA_COLOUR );
-
-	//Draw new ball
-	XTft_DrawSolidCircle(Tft, x, y);
+	//Erase the part of the previous ball the new one leaves, draw the part it did not cover
+	tft_movesprite(Tft, &ball_sprite, *ball_ptr_x - CIRCLE_RADIUS, *ball_ptr_y - CIRCLE_RADIUS,
+		&ball_sprite, x - CIRCLE_RADIUS, y - CIRCLE_RADIUS);
 
 	*ball_ptr_x = x;
 	*ball_ptr_y = y;
@@ -1613,37 +2045,235 @@ void drawBall(XTft *Tft, int x, int y, int* ball_ptr_x, int* ball_ptr_y)
 }
 
 // Draws a circle at centered at x, y
+// all the drawing functions record a primitive for tft_compose, caller is between tft_begin and tft_end
 void XTft_DrawSolidCircle(XTft *Tft, int x, int y)
 {
-	int radius = CIRCLE_RADIUS;
-	int i, j, height, pixel_x, pixel_y;
+	tft_drawsprite(Tft, &ball_sprite, x - CIRCLE_RADIUS, y - CIRCLE_RADIUS);
+}
 
-	pthread_mutex_lock(&uart_mutex);
-	//xil_printf("  Ball to draw at  to: %d, %d!\n", x, y);
-	pthread_mutex_unlock(&uart_mutex);
+// sprites are drawn in the game area, the part outside is cut off
+void tft_drawsprite(XTft *Tft, tft_sprite *sprite, int x, int y)
+{
+	tft_drawcmd cmd;
 
-	pthread_mutex_lock(&tft_mutex);
-	for(i=-radius; i<=radius; i++)
+	cmd.op = DRAWCMD_SPRITE;
+	sprite_rect(sprite, x, y, &cmd.rect);
+	if (cmd.rect.x1 > cmd.rect.x2 || cmd.rect.y1 > cmd.rect.y2)
+		return;
+	cmd.sprite = sprite;
+	cmd.x = x;
+	cmd.y = y;
+	tft_record(Tft, &cmd);
+}
+
+// glyphs are drawn outside the game area, over the HUD boxes
+void tft_drawglyph(XTft *Tft, int glyph, int x, int y)
+{
+	tft_drawcmd cmd;
+
+	cmd.op = DRAWCMD_SPRITE;
+	cmd.rect.x1 = x;
+	cmd.rect.y1 = y;
+	cmd.rect.x2 = x + XTFT_CHAR_WIDTH - 1;
+	cmd.rect.y2 = y + XTFT_CHAR_HEIGHT - 1;
+	cmd.sprite = &glyph_sprite[glyph];
+	cmd.x = x;
+	cmd.y = y;
+	tft_record(Tft, &cmd);
+}
+
+// moves a sprite drawn at ox, oy to x, y, or replaces it with another one
+// the pixels the old one leaves are copied from the background layer, for a solid sprite
+// that is still intact only the pixels it newly covers are drawn, in each row
+// both are one span so the difference is at most two spans on either side
+void tft_movesprite(XTft *Tft, tft_sprite *oldsprite, int ox, int oy, tft_sprite *sprite, int x, int y)
+{
+	tft_drawcmd cmd;
+	tft_rect newrect;
+
+	cmd.op = DRAWCMD_MOVE;
+	sprite_rect(oldsprite, ox, oy, &cmd.rect);
+	sprite_rect(sprite, x, y, &newrect);
+	if (cmd.rect.x1 > cmd.rect.x2 || cmd.rect.y1 > cmd.rect.y2)
+	{
+		cmd.rect = newrect;
+	}
+	else if (newrect.x1 <= newrect.x2 && newrect.y1 <= newrect.y2)
 	{
-		height = (int) ( sqrt(radius * radius - i * i) );
-		pixel_x = i + x;
+		if (newrect.x1 < cmd.rect.x1)
+			cmd.rect.x1 = newrect.x1;
+		if (newrect.y1 < cmd.rect.y1)
+			cmd.rect.y1 = newrect.y1;
+		if (newrect.x2 > cmd.rect.x2)
+			cmd.rect.x2 = newrect.x2;
+		if (newrect.y2 > cmd.rect.y2)
+			cmd.rect.y2 = newrect.y2;
+	}
+	if (cmd.rect.x1 > cmd.rect.x2 || cmd.rect.y1 > cmd.rect.y2)
+		return;
+	cmd.sprite = sprite;
+	cmd.x = x;
+	cmd.y = y;
+	cmd.oldsprite = oldsprite;
+	cmd.ox = ox;
+	cmd.oy = oy;
+	tft_record(Tft, &cmd);
+}
+
+// the part of the sprite at x, y that is in the game area, empty if none
+void sprite_rect(tft_sprite *sprite, int x, int y, tft_rect *rect)
+{
+	rect->x1 = x < GAMEAREA_LEFT ? GAMEAREA_LEFT : x;
+	rect->y1 = y < GAMEAREA_TOP ? GAMEAREA_TOP : y;
+	rect->x2 = x + sprite->width - 1 > GAMEAREA_RIGHT ? GAMEAREA_RIGHT : x + sprite->width - 1;
+	rect->y2 = y + sprite->height - 1 > GAMEAREA_BTM ? GAMEAREA_BTM : y + sprite->height - 1;
+}
+
+// visible pixels of the sprite at x, y in screen row row, within clip, returns 0 if there are none
+int sprite_span(tft_sprite *sprite, int x, int y, int row, tft_rect *clip, int *x1, int *x2)
+{
+	if (row < y || row >= y + sprite->height || row < clip->y1 || row > clip->y2)
+		return 0;
+	*x1 = x + sprite->left[row - y];
+	*x2 = x + sprite->right[row - y];
+	if (*x1 < clip->x1)
+		*x1 = clip->x1;
+	if (*x2 > clip->x2)
+		*x2 = clip->x2;
+	return *x1 <= *x2;
+}
 
-		for(j = -height; j<= height; j++)
+// renders the ball and both bars, called once before anything is drawn
+void sprite_init()
+{
+	int radius = CIRCLE_RADIUS;
+	int i, j, width;
+	// (x + 2*y + 1) % 3 == 0 is striped
+	const u32 stripe_tile[3*3] = {
+		SPRITE_KEY, SPRITE_KEY, BRICK_COLOUR_STRIPES,
+		BRICK_COLOUR_STRIPES, SPRITE_KEY, SPRITE_KEY,
+		SPRITE_KEY, BRICK_COLOUR_STRIPES, SPRITE_KEY,
+	};
+
+	// ball, pixels with i*i + j*j <= radius*radius
+	ball_sprite.width = 2*radius + 1;
+	ball_sprite.height = 2*radius + 1;
+	ball_sprite.pixels = ball_pixels;
+	for (j = 0; j < ball_sprite.width * ball_sprite.height; j++)
+	{
+		ball_pixels[j] = TFT_KEY;
+	}
+	for (j = -radius; j <= radius; j++)
+	{
+		width = (int) ( sqrt(radius * radius - j * j) );
+		tft_fillspan(ball_pixels + (j + radius) * ball_sprite.width + radius - width, 2*width + 1, tft_colour(BALL_COLOUR));
+	}
+	sprite_extents(&ball_sprite);
+
+	//multicolor bar
+	bar_sprite.width = 2*HALFBARLENG;
+	bar_sprite.height = BAR_BTM - BAR_TOP + 1;
+	bar_sprite.pixels = bar_pixels;
+	sprite_fill(&bar_sprite, 0, 9, BAR_A_COLOUR);
+	sprite_fill(&bar_sprite, 10, 19, BAR_S_COLOUR);
+	sprite_fill(&bar_sprite, HALFBARLENG-20, HALFBARLENG+19, BAR_COLOUR);
+	sprite_fill(&bar_sprite, 2*HALFBARLENG-20, 2*HALFBARLENG-11, BAR_S_COLOUR);
+	sprite_fill(&bar_sprite, 2*HALFBARLENG-10, 2*HALFBARLENG-1, BAR_A_COLOUR);
+	sprite_extents(&bar_sprite);
+
+	longbar_sprite.width = 4*HALFBARLENG;
+	longbar_sprite.height = BAR_BTM - BAR_TOP + 1;
+	longbar_sprite.pixels = longbar_pixels;
+	sprite_fill(&longbar_sprite, 0, 19, BAR_A_COLOUR);
+	sprite_fill(&longbar_sprite, 20, 39, BAR_S_COLOUR);
+	sprite_fill(&longbar_sprite, 2*HALFBARLENG-40, 2*HALFBARLENG+39, BAR_COLOUR);
+	sprite_fill(&longbar_sprite, 4*HALFBARLENG-40, 4*HALFBARLENG-21, BAR_S_COLOUR);
+	sprite_fill(&longbar_sprite, 4*HALFBARLENG-20, 4*HALFBARLENG-1, BAR_A_COLOUR);
+	sprite_extents(&longbar_sprite);
+
+	//bricks, the crystal stripes anchored at the brick's top left
+	pattern_init(&stripe_pattern, 3, 3, stripe_tile);
+	for (i = 0; i < 4; i++)
+	{
+		brick_tile[i].width = BRICK_LENGTH + 1;
+		brick_tile[i].height = BRICK_HEIGHT + 1;
+		brick_tile[i].pixels = brick_pixels[i];
+		sprite_fill(&brick_tile[i], 0, BRICK_LENGTH, (i & BRICK_TILE_RED) ? BRICK_COLOUR_RED : BRICK_COLOUR);
+		if (i & BRICK_TILE_CRYSTAL)
 		{
-			pixel_y = j + y;
-			//only draw the part of the ball that is within gamearea
-			if((pixel_x >= GAMEAREA_LEFT) && (pixel_x <= GAMEAREA_RIGHT) && (pixel_y >= GAMEAREA_TOP) && (pixel_y <= GAMEAREA_BTM))
-			XTft_SetPixel(Tft, pixel_x, pixel_y, BALL_COLOUR);
+			for (j = 0; j <= BRICK_HEIGHT; j++)
+			{
+				tft_patternspan(brick_pixels[i] + j * (BRICK_LENGTH+1), &stripe_pattern, 0, j, BRICK_LENGTH+1);
+			}
+		}
+		sprite_extents(&brick_tile[i]);
+	}
+	for (i = 0; i < TOTAL_ROWS; i++)
+	{
+		for (j = 0; j < TOTAL_COLUMNS; j++)
+		{
+			brick_rect[i][j].x1 = GAMEAREA_LEFT + 5 + INTERBRICK_X * j;
+			brick_rect[i][j].y1 = GAMEAREA_TOP + 5 + INTERBRICK_Y * i;
+			brick_rect[i][j].x2 = brick_rect[i][j].x1 + BRICK_LENGTH;
+			brick_rect[i][j].y2 = brick_rect[i][j].y1 + BRICK_HEIGHT;
 		}
 	}
-	pthread_mutex_unlock(&tft_mutex);
 
-	return;
+	// none of them is on screen yet
+	sprite_list[0] = &ball_sprite;
+	sprite_list[1] = &bar_sprite;
+	sprite_list[2] = &longbar_sprite;
+	for (j = 0; j < NUM_SPRITES; j++)
+	{
+		sprite_list[j]->onscreen.x1 = 0;
+		sprite_list[j]->onscreen.y1 = 0;
+		sprite_list[j]->onscreen.x2 = -1;
+		sprite_list[j]->onscreen.y2 = -1;
+		sprite_list[j]->intact = 0;
+	}
+}
+
+// fills columns x1..x2 of every row
+void sprite_fill(tft_sprite *sprite, int x1, int x2, unsigned int col)
+{
+	int y;
+
+	for (y = 0; y < sprite->height; y++)
+	{
+		tft_fillspan(sprite->pixels + y * sprite->width + x1, x2 - x1 + 1, tft_colour(col));
+	}
+}
+
+void sprite_extents(tft_sprite *sprite)
+{
+	tft_pixel *row = sprite->pixels;
+	int x, y;
+
+	sprite->masked = 0;
+	sprite->solid = 1;
+	for (y = 0; y < sprite->height; y++)
+	{
+		sprite->left[y] = 0;
+		while (sprite->left[y] < sprite->width && row[sprite->left[y]] == TFT_KEY)
+			sprite->left[y]++;
+		sprite->right[y] = sprite->width - 1;
+		while (sprite->right[y] >= 0 && row[sprite->right[y]] == TFT_KEY)
+			sprite->right[y]--;
+		for (x = sprite->left[y]; x <= sprite->right[y]; x++)
+		{
+			if (row[x] == TFT_KEY)
+				sprite->masked = 1;
+			else if (row[x] != sprite->pixels[sprite->left[0]])
+				sprite->solid = 0;
+		}
+		row += sprite->width;
+	}
 }
 
 int XTft_DrawSolidBox(XTft *Tft, int x1, int y1, int x2, int y2, unsigned int col)
 {
-	int xmin,xmax,ymin,ymax,i,j;
+	int xmin,xmax,ymin,ymax;
+	tft_drawcmd cmd;
 
 	//pthread_mutex_lock(&uart_mutex);
 	//xil_printf("  Box drawn at  to: %d, %d, %d, %d!\n", x1, y1, x2, y2);
@@ -1673,15 +2303,13 @@ int XTft_DrawSolidBox(XTft *Tft, int x1, int y1, int x2, int y2, unsigned int co
 			ymax = y2;
 		}
 
-		pthread_mutex_lock(&tft_mutex);
-		for (i=xmin; i<=xmax; i++)
-		{
-			for (j=ymin; j<=ymax; j++)
-			{
-				XTft_SetPixel(Tft, i, j, col);
-			}
-		}
-		pthread_mutex_unlock(&tft_mutex);
+		cmd.op = DRAWCMD_FILL;
+		cmd.rect.x1 = xmin;
+		cmd.rect.y1 = ymin;
+		cmd.rect.x2 = xmax;
+		cmd.rect.y2 = ymax;
+		cmd.col = tft_colour(col);
+		tft_record(Tft, &cmd);
 
 		return 0;	// returns 0 if draw is successful
 	}
@@ -1690,9 +2318,11 @@ int XTft_DrawSolidBox(XTft *Tft, int x1, int y1, int x2, int y2, unsigned int co
 
 }
 
-int XTft_DrawStripes(XTft *Tft, int x1, int y1, int x2, int y2, unsigned int col)
+// fills the box with the pattern repeated from the top left of the screen
+int XTft_DrawPattern(XTft *Tft, int x1, int y1, int x2, int y2, tft_pattern *pattern)
 {
-	int xmin,xmax,ymin,ymax,i,j;
+	int xmin,xmax,ymin,ymax;
+	tft_drawcmd cmd;
 
 	//pthread_mutex_lock(&uart_mutex);
 	//xil_printf("  Box drawn at  to: %d, %d, %d, %d!\n", x1, y1, x2, y2);
@@ -1722,21 +2352,13 @@ int XTft_DrawStripes(XTft *Tft, int x1, int y1, int x2, int y2, unsigned int col
 			ymax = y2;
 		}
 
-		pthread_mutex_lock(&tft_mutex);
-		for (i=xmin; i<=xmax; i++)
-		{
-			for (j=ymin; j<=ymax; j++)
-			{
-				if (i%3 ==0 && j %3 ==1 )
-					XTft_SetPixel(Tft, i, j, col);
-				else if (i%3 == 1 && j %3 ==2 )
-					XTft_SetPixel(Tft, i, j, col);
-				else if (i%3 == 2 && j %3 ==0)
-					XTft_SetPixel(Tft, i, j, col);
-
-			}
-		}
-		pthread_mutex_unlock(&tft_mutex);
+		cmd.op = DRAWCMD_PATTERN;
+		cmd.rect.x1 = xmin;
+		cmd.rect.y1 = ymin;
+		cmd.rect.x2 = xmax;
+		cmd.rect.y2 = ymax;
+		cmd.pattern = pattern;
+		tft_record(Tft, &cmd);
 
 		return 0;	// returns 0 if draw is successful
 	}
@@ -1745,120 +2367,1903 @@ int XTft_DrawStripes(XTft *Tft, int x1, int y1, int x2, int y2, unsigned int col
 
 }
 
-void XTft_DrawTextBox(XTft *Tft, int x1, int y1, int x2, int y2, char* cstringtext)
+// the background layer is drawn straight away with tft_mutex held, what changed
+// in it is put on screen by tft_restore
+void tft_bgbox(int x1, int y1, int x2, int y2, unsigned int col)
 {
-	char* txtptr = cstringtext;
-	int cstringleng = 0;
+	tft_pixel *row = (tft_pixel *) TFT_BACKGROUND_ADDR + y1 * XTFT_DISPLAY_BUFFER_WIDTH;
+	tft_pixel pixel = tft_colour(col);
 
-	// Check cstringtext ends with a NULL
-	while(*txtptr != '\0')
+	for (; y1 <= y2; y1++, row += XTFT_DISPLAY_BUFFER_WIDTH)
 	{
-		txtptr++;
-		cstringleng++;
-		if (cstringleng > 10)	//do not expect cstringtext to be longer than 9 chars
-		return;
+		tft_fillspan(row + x1, x2 - x1 + 1, pixel);
 	}
-	if (cstringleng==0) 	//stop printing if cstringtext is empty
-	return;
-	else 	// move txtptr back to start of cstringtext
-	txtptr = cstringtext;
-
-	//draw bgbox first - also help to erase previous info
-	XTft_DrawSolidBox(Tft, x1, y1, x2, y2, TEXTBOX_COLOUR);
+}
 
-	// draw text after that
-	pthread_mutex_lock(&tft_mutex);
-	XTft_SetPos(Tft, x1, y1);
-	XTft_SetPosChar(Tft, x1+3, y1+5);
-	XTft_SetColor(Tft, TEXT_COLOUR, TEXTBOX_COLOUR);
+void tft_bgtile(tft_sprite *tile, int x, int y)
+{
+	tft_pixel *row = (tft_pixel *) TFT_BACKGROUND_ADDR + y * XTFT_DISPLAY_BUFFER_WIDTH + x;
+	tft_pixel *src = tile->pixels;
+	int j;
 
-	while(*txtptr != '\0')
+	for (j = 0; j < tile->height; j++, row += XTFT_DISPLAY_BUFFER_WIDTH, src += tile->width)
 	{
-		XTft_Write(Tft, *txtptr);
-		txtptr++;
+		memcpy(row, src, tile->width * sizeof(tft_pixel));
 	}
-	pthread_mutex_unlock(&tft_mutex);
-
 }
 
-void XTft_DrawNumberBox(XTft *Tft, int x1, int y1, int x2, int y2, int someNumber)
+// copies the rectangle from the background layer, over whatever was drawn there
+void tft_restore(XTft *Tft, int x1, int y1, int x2, int y2)
 {
-	char txtbuffer[10] = "";
-	numbertocstring(someNumber, txtbuffer);
-	XTft_DrawTextBox(Tft, x1, y1, x2, y2, txtbuffer);
+	tft_drawcmd cmd;
+
+	cmd.op = DRAWCMD_RESTORE;
+	cmd.rect.x1 = x1;
+	cmd.rect.y1 = y1;
+	cmd.rect.x2 = x2;
+	cmd.rect.y2 = y2;
+	tft_record(Tft, &cmd);
 }
 
-void numbertocstring(int num, char* charptr)
+// count pixels of row y of the pattern from column x on, the pattern repeats from 0, 0
+// the rows are expanded by pattern_init so the span is one copy, a masked one stores
+// only the opaque columns, each a stride of width from its first place in the span
+void tft_patternspan(tft_pixel *dst, tft_pattern *pattern, int x, int y, int count)
 {
-	int reversednum = 0;
-	int digitcount = 0;
+	int row = y % pattern->height;
+	int phase = x % pattern->width;
+	tft_pixel *src = pattern->rows[row] + phase;
+	int i, j;
 
-	if (num == 0)
+	if (pattern->masked == 0)
 	{
-		*charptr = 48;
-		charptr++;
-		*charptr = '\0';
+		memcpy(dst, src, count * sizeof(tft_pixel));
 		return;
 	}
+	for (j = 0; j < pattern->opaque_count[row]; j++)
+	{
+		i = (pattern->opaque[row][j] - phase + pattern->width) % pattern->width;
+		for (; i < count; i += pattern->width)
+		{
+			dst[i] = src[i];
+		}
+	}
+}
 
-	while (num != 0)
+// tile is width by height 0x00RRGGBB colours or SPRITE_KEY, row by row
+void pattern_init(tft_pattern *pattern, int width, int height, const u32 *tile)
+{
+	int x, y;
+
+	pattern->width = width;
+	pattern->height = height;
+	pattern->masked = 0;
+	for (y = 0; y < height; y++)
 	{
-		reversednum = reversednum * 10;
-		reversednum = reversednum + num % 10;
-		num = num / 10;
-		digitcount++;
+		pattern->opaque_count[y] = 0;
+		for (x = 0; x < PATTERN_ROW; x++)
+		{
+			pattern->rows[y][x] = tft_colour(tile[y * width + x % width]);
+			if (pattern->rows[y][x] == TFT_KEY)
+				pattern->masked = 1;
+			else if (x < width)
+				pattern->opaque[y][pattern->opaque_count[y]++] = x;
+		}
 	}
-	while(digitcount!=0)
+}
+
+// unrolled so that the stores to a row go out back to back
+void tft_fillspan(tft_pixel *dst, int count, tft_pixel col)
+{
+	while (count >= 4)
 	{
-		*charptr = (reversednum % 10) + 48;  //convert digit to its corresponding ascii
-		reversednum =  reversednum/ 10;
-		charptr++;
-		digitcount--;
+		dst[0] = col;
+		dst[1] = col;
+		dst[2] = col;
+		dst[3] = col;
+		dst += 4;
+		count -= 4;
+	}
+	while (count > 0)
+	{
+		*dst++ = col;
+		count--;
 	}
-	*charptr = '\0';     // terminates with null
 }
 
-int generatebitmask(int brickrow)
+// the pixel composed for a 0x00RRGGBB colour or SPRITE_KEY, with TFT_PALETTE its index in
+// tft_palette, added the first time the colour is asked for, the nearest one once it is full
+// only thread_render and main_prog before it starts ask, the tile workers never do
+tft_pixel tft_colour(unsigned int col)
 {
-	//debug
-	// use
-	//int bitmask = 1 << brickrow;	//bitshift
-	//return !bitmask;	//invert
-	switch(brickrow)
+#if TFT_PALETTE
+	int i, best, dist, bestdist, dr, dg, db;
+
+	for (i = 0; i < tft_colours; i++)
 	{
-		case 1:
-		return 0xfe;
-		case 2:
-		return 0xfd;
-		case 3:
-		return 0xfb;
-		case 4:
-		return 0xf7;
-		case 5:
-		return 0xef;
-		case 6:
-		return 0xdf;
-		case 7:
-		return 0xbf;
-		case 8:
-		return 0x7f;
-		default:
-		return 0xff;
+		if (tft_palette[i] == col)
+			return i;
+	}
+	if (tft_colours < TFT_PALETTE_SIZE)
+	{
+		tft_palette[tft_colours] = col;
+		return tft_colours++;
+	}
+	best = 1;
+	bestdist = 0x7fffffff;
+	for (i = 1; i < TFT_PALETTE_SIZE; i++)
+	{
+		dr = (int) ((tft_palette[i] >> 16) & 0xff) - (int) ((col >> 16) & 0xff);
+		dg = (int) ((tft_palette[i] >> 8) & 0xff) - (int) ((col >> 8) & 0xff);
+		db = (int) (tft_palette[i] & 0xff) - (int) (col & 0xff);
+		dist = dr * dr + dg * dg + db * db;
+		if (dist < bestdist)
+		{
+			best = i;
+			bestdist = dist;
+		}
+	}
+	return best;
+#else
+	return col;
+#endif
+}
+
+// takes tft_mutex for a group of drawing functions, which only record what
+// they draw, the group is composed as a whole and never shown in part
+void tft_begin()
+{
+	pthread_mutex_lock(&tft_mutex);
+	framestats.locks++;
+}
+
+void tft_end()
+{
+	pthread_mutex_unlock(&tft_mutex);
+}
+
+// caller holds tft_mutex
+void tft_record(XTft *Tft, tft_drawcmd *cmd)
+{
+	if (drawcmd_count == MAX_DRAWCMDS)
+	{
+		tft_compose(Tft);
 	}
+	drawcmd[drawcmd_count] = *cmd;
+	drawcmd_count++;
+	tft_addrect(pending, &pending_count, &pending_full, &cmd->rect);
+	framestats.primitives++;
 }
 
-void resetHandler()
+// adds a rectangle to a list of separate ones, merging it with every one it
+// overlaps, when the list is full the whole screen is taken instead
+void tft_addrect(tft_rect *list, int *count, int *full, tft_rect *rect)
 {
-	int ret;
+	tft_rect merged = *rect;
+	int i, found;
 
-	//launches thread_reset which will carry out the reset operation
-	ret = pthread_create(&treset, NULL, (void*) thread_reset, NULL);
-	if (ret != 0)
+	if (*full == 1)
+		return;
+
+	do
+	{
+		found = 0;
+		for (i = 0; i < *count; i++)
+		{
+			if (merged.x1 <= list[i].x2 && merged.x2 >= list[i].x1 && merged.y1 <= list[i].y2 && merged.y2 >= list[i].y1)
+			{
+				if (list[i].x1 < merged.x1)
+					merged.x1 = list[i].x1;
+				if (list[i].y1 < merged.y1)
+					merged.y1 = list[i].y1;
+				if (list[i].x2 > merged.x2)
+					merged.x2 = list[i].x2;
+				if (list[i].y2 > merged.y2)
+					merged.y2 = list[i].y2;
+				(*count)--;
+				list[i] = list[*count];
+				found = 1;
+				break;
+			}
+		}
+	} while (found == 1);
+
+	if (*count == MAX_DAMAGE)
 	{
-		xil_printf("-- ERROR (%d) launching thread_reset...\r\n", ret);
+		*full = 1;
+		return;
 	}
-	else
+	list[*count] = merged;
+	(*count)++;
+}
+
+// draws the recorded primitives into the back frame, caller holds tft_mutex
+// the merged rectangles are walked top to bottom, every row is built in
+// composer.line from the primitives crossing it and only the pixels they cover
+// are stored, so a pixel drawn over several times goes to video memory once
+void tft_compose(XTft *Tft)
+{
+	int cmds[MAX_DRAWCMDS];
+	int i, j, k, n;
+	tft_rect area, *cmdrect;
+	tft_drawcmd *cmd;
+
+	// how much of a moving sprite is drawn depends on whether it is still on screen as it was left
+	for (j = 0; j < drawcmd_count; j++)
 	{
-		xil_printf("thread_reset launched with ID %d \r\n", treset);
+		cmd = &drawcmd[j];
+		if (cmd->op == DRAWCMD_MOVE)
+		{
+			sprite_rect(cmd->oldsprite, cmd->ox, cmd->oy, &area);
+			cmd->full = cmd->oldsprite != cmd->sprite || cmd->sprite->solid == 0 || cmd->sprite->masked == 1
+				|| cmd->oldsprite->intact == 0 || area.x1 != cmd->oldsprite->onscreen.x1 || area.y1 != cmd->oldsprite->onscreen.y1
+				|| area.x2 != cmd->oldsprite->onscreen.x2 || area.y2 != cmd->oldsprite->onscreen.y2;
+			cmd->oldsprite->intact = 0;
+		}
+		if (cmd->op == DRAWCMD_MOVE || cmd->op == DRAWCMD_SPRITE)
+		{
+			sprite_rect(cmd->sprite, cmd->x, cmd->y, &cmd->sprite->onscreen);
+			cmd->sprite->intact = 1;
+			continue;
+		}
+		for (k = 0; k < NUM_SPRITES; k++)
+		{
+			cmdrect = &sprite_list[k]->onscreen;
+			if (cmdrect->x1 <= cmd->rect.x2 && cmdrect->x2 >= cmd->rect.x1 && cmdrect->y1 <= cmd->rect.y2 && cmdrect->y2 >= cmd->rect.y1)
+				sprite_list[k]->intact = 0;
+		}
+	}
+
+	if (pending_full == 1)
+	{
+		pending_count = 1;
+		pending[0].x1 = 0;
+		pending[0].y1 = 0;
+		pending[0].x2 = DISPLAY_COLUMNS-1;
+		pending[0].y2 = DISPLAY_ROWS-1;
+	}
+
+	// scanline order
+	for (i = 1; i < pending_count; i++)
+	{
+		area = pending[i];
+		for (j = i; j > 0 && (pending[j-1].y1 > area.y1 || (pending[j-1].y1 == area.y1 && pending[j-1].x1 > area.x1)); j--)
+		{
+			pending[j] = pending[j-1];
+		}
+		pending[j] = area;
+	}
+
+	for (i = 0; i < pending_count; i++)
+	{
+		area = pending[i];
+		n = 0;
+		for (j = 0; j < drawcmd_count; j++)
+		{
+			cmdrect = &drawcmd[j].rect;
+			if (cmdrect->x1 <= area.x2 && cmdrect->x2 >= area.x1 && cmdrect->y1 <= area.y2 && cmdrect->y2 >= area.y1)
+			{
+				cmds[n] = j;
+				n++;
+			}
+		}
+
+		tft_composearea(Tft, &area, cmds, n);
+
+		// text goes through XTft_Write after the rows, a text hidden by a later box is dropped
+		// nothing else is drawn over part of a text box
+		for (j = 0; j < n; j++)
+		{
+			cmd = &drawcmd[cmds[j]];
+			if (cmd->op != DRAWCMD_TEXT)
+				continue;
+			for (k = cmds[j] + 1; k < drawcmd_count; k++)
+			{
+				cmdrect = &drawcmd[k].rect;
+				if (drawcmd[k].op == DRAWCMD_FILL && cmdrect->x1 <= cmd->rect.x1 && cmdrect->x2 >= cmd->rect.x2
+					&& cmdrect->y1 <= cmd->rect.y1 && cmdrect->y2 >= cmd->rect.y2)
+					break;
+			}
+			if (k < drawcmd_count)
+				continue;
+
+			XTft_SetPosChar(Tft, cmd->x, cmd->y);
+			XTft_SetColor(Tft, cmd->col, TEXTBOX_COLOUR);
+			for (k = 0; cmd->text[k] != '\0'; k++)
+			{
+				XTft_Write(Tft, cmd->text[k]);
+			}
+#if TFT_PALETTE
+			tft_indexrect(TFT_TEXT_ADDR, &cmd->rect);
+#endif
+			k = (cmd->rect.x2 - cmd->rect.x1 + 1) * (cmd->rect.y2 - cmd->rect.y1 + 1);
+			framestats.drawn += k;
+			framestats.written += k;
+		}
+
+		tft_addrect(damage, &damage_count, &damage_full, &area);
+	}
+
+	framestats.drawn += composer.drawn;
+	framestats.written += composer.written;
+	composer.drawn = 0;
+	composer.written = 0;
+#if TFT_TILE_THREADS > 1
+	for (i = 1; i < tile_started; i++)
+	{
+		framestats.drawn += tile_composer[i].drawn;
+		framestats.written += tile_composer[i].written;
+		tile_composer[i].drawn = 0;
+		tile_composer[i].written = 0;
+	}
+#endif
+
+	drawcmd_count = 0;
+	pending_count = 0;
+	pending_full = 0;
+}
+
+// the rows of area from the primitives in cmds[], a large one in tiles when there are tile workers
+void tft_composearea(XTft *Tft, tft_rect *area, int *cmds, int ncmds)
+{
+	int y;
+
+#if TFT_TILE_THREADS > 1
+	if (tile_threads > 1 && (area->x2 - area->x1 + 1) * (area->y2 - area->y1 + 1) >= TFT_TILE_MIN)
+	{
+		tft_composetiles(Tft, area, cmds, ncmds);
+		return;
+	}
+#endif
+	for (y = area->y1; y <= area->y2; y++)
+	{
+		tft_composerow(&composer, Tft, area, y, cmds, ncmds);
+	}
+}
+
+#if TFT_TILE_THREADS > 1
+// threads composing from now on, thread_render included, workers are launched the first time they are needed
+void tft_tilethreads(int threads)
+{
+	int ret;
+
+	if (threads < 1)
+		threads = 1;
+	if (threads > TFT_TILE_THREADS)
+		threads = TFT_TILE_THREADS;
+	if (tile_started == 1)
+	{
+		sem_init(&sem_tilework, 1, 0);
+		sem_init(&sem_tiledone, 1, 0);
+	}
+	for (; tile_started < threads; tile_started++)
+	{
+		ret = pthread_create(&ttile[tile_started], NULL, (void*) thread_tile, &tile_composer[tile_started]);
+		if (ret != 0)
+		{
+			xil_printf("-- ERROR (%d) launching thread_tile...\r\n", ret);
+			break;
+		}
+	}
+	tile_threads = threads < tile_started ? threads : tile_started;
+}
+
+// splits area along a grid of TFT_TILE_WIDTH by TFT_TILE_HEIGHT tiles and composes them on
+// tile_threads threads, each row of a tile is built the same as tft_composerow builds the
+// whole row and no two tiles share a pixel, so the frame is the same as composed by one
+// the text boxes are left to tft_compose, which writes them after this returns
+void tft_composetiles(XTft *Tft, tft_rect *area, int *cmds, int ncmds)
+{
+	int i, tile;
+
+	tile_tft = Tft;
+	tile_area = *area;
+	tile_cmds = cmds;
+	tile_ncmds = ncmds;
+	tile_columns = area->x2 / TFT_TILE_WIDTH - area->x1 / TFT_TILE_WIDTH + 1;
+	tile_count = tile_columns * (area->y2 / TFT_TILE_HEIGHT - area->y1 / TFT_TILE_HEIGHT + 1);
+	__atomic_store_n(&tile_next, 0, __ATOMIC_RELAXED);
+	for (i = 1; i < tile_threads; i++)
+	{
+		sem_post(&sem_tilework);
+	}
+
+	while ((tile = __atomic_fetch_add(&tile_next, 1, __ATOMIC_RELAXED)) < tile_count)
+	{
+		tft_composetile(&composer, tile);
+	}
+	for (i = 1; i < tile_threads; i++)
+	{
+		sem_wait(&sem_tiledone);
+	}
+	framestats.tiled++;
+}
+
+// the part of tile_area in its tile-th tile, from the primitives that cross it
+void tft_composetile(tft_composer *c, int tile)
+{
+	int cmds[MAX_DRAWCMDS];
+	tft_rect clip, *cmdrect;
+	int i, n, y;
+
+	clip.x1 = (tile_area.x1 / TFT_TILE_WIDTH + tile % tile_columns) * TFT_TILE_WIDTH;
+	clip.y1 = (tile_area.y1 / TFT_TILE_HEIGHT + tile / tile_columns) * TFT_TILE_HEIGHT;
+	clip.x2 = clip.x1 + TFT_TILE_WIDTH - 1;
+	clip.y2 = clip.y1 + TFT_TILE_HEIGHT - 1;
+	if (clip.x1 < tile_area.x1)
+		clip.x1 = tile_area.x1;
+	if (clip.y1 < tile_area.y1)
+		clip.y1 = tile_area.y1;
+	if (clip.x2 > tile_area.x2)
+		clip.x2 = tile_area.x2;
+	if (clip.y2 > tile_area.y2)
+		clip.y2 = tile_area.y2;
+
+	n = 0;
+	for (i = 0; i < tile_ncmds; i++)
+	{
+		cmdrect = &drawcmd[tile_cmds[i]].rect;
+		if (cmdrect->x1 <= clip.x2 && cmdrect->x2 >= clip.x1 && cmdrect->y1 <= clip.y2 && cmdrect->y2 >= clip.y1)
+		{
+			cmds[n] = tile_cmds[i];
+			n++;
+		}
+	}
+	for (y = clip.y1; y <= clip.y2; y++)
+	{
+		tft_composerow(c, tile_tft, &clip, y, cmds, n);
+	}
+}
+
+// takes tiles of the area tft_composetiles posted until none is left
+void* thread_tile(void *arg)
+{
+	tft_composer *c = arg;
+	int tile;
+
+	while (1)
+	{
+		sem_wait(&sem_tilework);
+		while ((tile = __atomic_fetch_add(&tile_next, 1, __ATOMIC_RELAXED)) < tile_count)
+		{
+			tft_composetile(c, tile);
+		}
+		sem_post(&sem_tiledone);
+	}
+}
+#endif
+
+// builds row y of area from the primitives in cmds[] and stores the pixels they cover
+void tft_composerow(tft_composer *c, XTft *Tft, tft_rect *area, int y, int *cmds, int ncmds)
+{
+	tft_pixel *row = (tft_pixel *) TFT_COMPOSE_ADDR(Tft) + y * XTFT_DISPLAY_BUFFER_WIDTH;
+	int i, x1, x2, ox1, ox2, hasold;
+	tft_rect clip;
+	tft_drawcmd *cmd;
+
+	c->spans = 0;
+	for (i = 0; i < ncmds; i++)
+	{
+		cmd = &drawcmd[cmds[i]];
+		if (y < cmd->rect.y1 || y > cmd->rect.y2 || cmd->op == DRAWCMD_TEXT)
+			continue;
+		clip.x1 = cmd->rect.x1 > area->x1 ? cmd->rect.x1 : area->x1;
+		clip.x2 = cmd->rect.x2 < area->x2 ? cmd->rect.x2 : area->x2;
+		clip.y1 = cmd->rect.y1;
+		clip.y2 = cmd->rect.y2;
+		x1 = clip.x1;
+		x2 = clip.x2;
+
+		if (cmd->op == DRAWCMD_MOVE)
+		{
+			hasold = sprite_span(cmd->oldsprite, cmd->ox, cmd->oy, y, &clip, &ox1, &ox2);
+			if (sprite_span(cmd->sprite, cmd->x, cmd->y, y, &clip, &x1, &x2) == 0)
+			{
+				if (hasold)
+					tft_composebg(c, row, y, ox1, ox2);
+				continue;
+			}
+			if (hasold == 0 || x1 > ox2 || x2 < ox1)
+			{
+				if (hasold)
+					tft_composebg(c, row, y, ox1, ox2);
+				tft_composesprite(c, row, cmd->sprite, cmd->x, cmd->y, y, x1, x2);
+				continue;
+			}
+			if (ox1 < x1)
+				tft_composebg(c, row, y, ox1, x1 - 1);
+			if (ox2 > x2)
+				tft_composebg(c, row, y, x2 + 1, ox2);
+			if (cmd->full == 1)
+			{
+				tft_composesprite(c, row, cmd->sprite, cmd->x, cmd->y, y, x1, x2);
+				continue;
+			}
+			if (x1 < ox1)
+				tft_composesprite(c, row, cmd->sprite, cmd->x, cmd->y, y, x1, ox1 - 1);
+			if (x2 > ox2)
+				tft_composesprite(c, row, cmd->sprite, cmd->x, cmd->y, y, ox2 + 1, x2);
+		}
+		else if (cmd->op == DRAWCMD_SPRITE)
+		{
+			if (sprite_span(cmd->sprite, cmd->x, cmd->y, y, &clip, &x1, &x2))
+				tft_composesprite(c, row, cmd->sprite, cmd->x, cmd->y, y, x1, x2);
+		}
+		else if (cmd->op == DRAWCMD_RESTORE)
+		{
+			tft_composebg(c, row, y, x1, x2);
+		}
+		else if (cmd->op == DRAWCMD_PATTERN)
+		{
+			tft_composecover(c, row, x1, x2, cmd->pattern->masked);
+			tft_patternspan(c->line + x1, cmd->pattern, x1, y, x2 - x1 + 1);
+			c->drawn += x2 - x1 + 1;
+		}
+		else
+		{
+			tft_composefill(c, row, x1, x2, cmd->col);
+		}
+	}
+
+	for (i = 0; i < c->spans; i++)
+	{
+		memcpy(row + c->x1[i], c->line + c->x1[i], (c->x2[i] - c->x1[i] + 1) * sizeof(tft_pixel));
+		c->written += c->x2[i] - c->x1[i] + 1;
+	}
+}
+
+void tft_composefill(tft_composer *c, tft_pixel *row, int x1, int x2, tft_pixel col)
+{
+	tft_fillspan(c->line + x1, x2 - x1 + 1, col);
+	tft_composecover(c, row, x1, x2, 0);
+	c->drawn += x2 - x1 + 1;
+}
+
+// copies x1..x2 of row y from the background layer
+void tft_composebg(tft_composer *c, tft_pixel *row, int y, int x1, int x2)
+{
+	memcpy(c->line + x1, (tft_pixel *) TFT_BACKGROUND_ADDR + y * XTFT_DISPLAY_BUFFER_WIDTH + x1, (x2 - x1 + 1) * sizeof(tft_pixel));
+	tft_composecover(c, row, x1, x2, 0);
+	c->drawn += x2 - x1 + 1;
+}
+
+// columns x1..x2 of the sprite at x, y in screen row row_y
+void tft_composesprite(tft_composer *c, tft_pixel *row, tft_sprite *sprite, int x, int y, int row_y, int x1, int x2)
+{
+	tft_pixel *src = sprite->pixels + (row_y - y) * sprite->width + x1 - x;
+	int i;
+
+	if (sprite->masked == 1)
+	{
+		tft_composecover(c, row, x1, x2, 1);
+		for (i = x1; i <= x2; i++, src++)
+		{
+			if (*src != TFT_KEY)
+				c->line[i] = *src;
+		}
+	}
+	else
+	{
+		memcpy(c->line + x1, src, (x2 - x1 + 1) * sizeof(tft_pixel));
+		tft_composecover(c, row, x1, x2, 0);
+	}
+	c->drawn += x2 - x1 + 1;
+}
+
+// marks x1..x2 of c->line as drawn, with load set the part not drawn
+// yet is first read from video memory, for primitives that leave pixels alone
+void tft_composecover(tft_composer *c, tft_pixel *row, int x1, int x2, int load)
+{
+	int i, j, from, to;
+
+	if (load == 1)
+	{
+		from = x1;
+		for (i = 0; i < c->spans && from <= x2; i++)
+		{
+			if (c->x2[i] < from)
+				continue;
+			to = c->x1[i] - 1 < x2 ? c->x1[i] - 1 : x2;
+			if (from <= to)
+				memcpy(c->line + from, row + from, (to - from + 1) * sizeof(tft_pixel));
+			from = c->x2[i] + 1;
+		}
+		if (from <= x2)
+			memcpy(c->line + from, row + from, (x2 - from + 1) * sizeof(tft_pixel));
+	}
+
+	// spans i..j-1 touch x1..x2 and become one
+	i = 0;
+	while (i < c->spans && c->x2[i] < x1 - 1)
+		i++;
+	j = i;
+	while (j < c->spans && c->x1[j] <= x2 + 1)
+	{
+		if (c->x1[j] < x1)
+			x1 = c->x1[j];
+		if (c->x2[j] > x2)
+			x2 = c->x2[j];
+		j++;
+	}
+
+	if (i == j && c->spans == MAX_SPANS)
+	{
+		// no room for another run, join the one to the left reading the gap in between
+		if (i == 0)
+		{
+			memcpy(c->line + x2 + 1, row + x2 + 1, (c->x1[0] - x2 - 1) * sizeof(tft_pixel));
+			x2 = c->x2[0];
+		}
+		else
+		{
+			i--;
+			memcpy(c->line + c->x2[i] + 1, row + c->x2[i] + 1, (x1 - c->x2[i] - 1) * sizeof(tft_pixel));
+			x1 = c->x1[i];
+		}
+		j = i + 1;
+	}
+
+	if (i == j)
+	{
+		for (j = c->spans; j > i; j--)
+		{
+			c->x1[j] = c->x1[j-1];
+			c->x2[j] = c->x2[j-1];
+		}
+		c->spans++;
+	}
+	else
+	{
+		// drop spans i+1..j-1
+		for (from = i + 1, to = j; to < c->spans; from++, to++)
+		{
+			c->x1[from] = c->x1[to];
+			c->x2[from] = c->x2[to];
+		}
+		c->spans -= j - i - 1;
+	}
+	c->x1[i] = x1;
+	c->x2[i] = x2;
+}
+
+// frames of tft_pixel, the frames on screen unless TFT_PALETTE
+void tft_copyrect(UINTPTR from, UINTPTR to, tft_rect *rect)
+{
+	tft_pixel *src = (tft_pixel *) from + rect->y1 * XTFT_DISPLAY_BUFFER_WIDTH + rect->x1;
+	tft_pixel *dst = (tft_pixel *) to + rect->y1 * XTFT_DISPLAY_BUFFER_WIDTH + rect->x1;
+	int width = rect->x2 - rect->x1 + 1;
+	int y;
+
+	for (y = rect->y1; y <= rect->y2; y++)
+	{
+		memcpy(dst, src, width * sizeof(tft_pixel));
+		src += XTFT_DISPLAY_BUFFER_WIDTH;
+		dst += XTFT_DISPLAY_BUFFER_WIDTH;
+	}
+	framestats.copied += width * (rect->y2 - rect->y1 + 1);
+}
+
+// the visible part of the frame black, a row at a time rather than a pixel at a time like XTft_ClearScreen
+void tft_clearframe(UINTPTR frame)
+{
+	u32 *row = (u32 *) frame;
+	int y;
+
+	for (y = 0; y < DISPLAY_ROWS; y++, row += XTFT_DISPLAY_BUFFER_WIDTH)
+	{
+		memset(row, 0, DISPLAY_COLUMNS * sizeof(u32));
+	}
+}
+
+#if TFT_PALETTE
+// the rectangle of a frame XTft_Write drew into, indexed into the frame being composed
+void tft_indexrect(UINTPTR from, tft_rect *rect)
+{
+	u32 *src = (u32 *) from + rect->y1 * XTFT_DISPLAY_BUFFER_WIDTH;
+	tft_pixel *dst = (tft_pixel *) TFT_INDEX_ADDR + rect->y1 * XTFT_DISPLAY_BUFFER_WIDTH;
+	u32 last = SPRITE_KEY;
+	tft_pixel index = TFT_KEY;
+	int x, y;
+
+	for (y = rect->y1; y <= rect->y2; y++, src += XTFT_DISPLAY_BUFFER_WIDTH, dst += XTFT_DISPLAY_BUFFER_WIDTH)
+	{
+		for (x = rect->x1; x <= rect->x2; x++)
+		{
+			// text is two colours, the palette is looked up when it changes
+			if (src[x] != last)
+			{
+				last = src[x];
+				index = tft_colour(last);
+			}
+			dst[x] = index;
+		}
+	}
+}
+
+// the rectangle of the frame composed, looked up in tft_palette into a frame the TFT shows
+void tft_expandrect(UINTPTR to, tft_rect *rect)
+{
+	tft_pixel *src = (tft_pixel *) TFT_INDEX_ADDR + rect->y1 * XTFT_DISPLAY_BUFFER_WIDTH;
+	u32 *dst = (u32 *) to + rect->y1 * XTFT_DISPLAY_BUFFER_WIDTH;
+	int x, y;
+
+	for (y = rect->y1; y <= rect->y2; y++, src += XTFT_DISPLAY_BUFFER_WIDTH, dst += XTFT_DISPLAY_BUFFER_WIDTH)
+	{
+		for (x = rect->x1; x <= rect->x2; x++)
+		{
+			dst[x] = tft_palette[src[x]];
+		}
+	}
+	framestats.expanded += (rect->x2 - rect->x1 + 1) * (rect->y2 - rect->y1 + 1);
+}
+
+// everything composed since the last present
+void tft_expanddamage(UINTPTR to)
+{
+	tft_rect whole = {0, 0, DISPLAY_COLUMNS-1, DISPLAY_ROWS-1};
+	int i;
+
+	if (damage_full == 1)
+	{
+		tft_expandrect(to, &whole);
+		return;
+	}
+	for (i = 0; i < damage_count; i++)
+	{
+		tft_expandrect(to, &damage[i]);
+	}
+}
+#endif
+
+// copies the rectangles of a screen kept at from into the back frame, in place of everything
+// recorded and not yet composed, which the screen covers, caller is between tft_begin and tft_end
+// the sprites are not on it, they are drawn whole again
+void tft_loadscreen(XTft *Tft, UINTPTR from, tft_rect *rects, int count)
+{
+	int i;
+
+	drawcmd_count = 0;
+	pending_count = 0;
+	pending_full = 0;
+	for (i = 0; i < NUM_SPRITES; i++)
+	{
+		sprite_list[i]->onscreen.x1 = 0;
+		sprite_list[i]->onscreen.y1 = 0;
+		sprite_list[i]->onscreen.x2 = -1;
+		sprite_list[i]->onscreen.y2 = -1;
+		sprite_list[i]->intact = 0;
+	}
+	for (i = 0; i < count; i++)
+	{
+		tft_copyrect(from, TFT_COMPOSE_ADDR(Tft), &rects[i]);
+		tft_addrect(damage, &damage_count, &damage_full, &rects[i]);
+		framestats.loaded += (rects[i].x2 - rects[i].x1 + 1) * (rects[i].y2 - rects[i].y1 + 1);
+	}
+}
+
+// puts everything drawn since the last call on screen, called by thread_render at RENDER_PRESENT
+// the recorded primitives are composed into the back frame, which is shown from the next
+// vsync, then what was drawn into it is copied into the frame that was on screen, which
+// becomes the new back frame
+// with TFT_PALETTE they are composed into the index frame and what was drawn is expanded
+// into the back frame before the flip and into the new back frame after it
+// returns timestamp() when the frame was on screen, when the TFT latched it with DOUBLE_BUFFER,
+// 0 if nothing was drawn
+unsigned int tft_present(XTft *Tft)
+{
+	unsigned int now, interval, stage_start;
+#if DOUBLE_BUFFER
+	unsigned int waitstart;
+	UINTPTR shown;
+#if !TFT_PALETTE
+	int i;
+	tft_rect whole = {0, 0, DISPLAY_COLUMNS-1, DISPLAY_ROWS-1};
+#endif
+#endif
+
+	pthread_mutex_lock(&tft_mutex);
+	framestats.locks++;
+	STAGE_BEGIN(stage_start);
+	tft_compose(Tft);
+	STAGE_END(STAGE_COMPOSE, stage_start);
+	if (damage_count == 0 && damage_full == 0)
+	{
+		pthread_mutex_unlock(&tft_mutex);
+		return 0;
+	}
+
+#if TFT_PALETTE
+	tft_expanddamage(frame_back);
+#endif
+#if DOUBLE_BUFFER
+	waitstart = timestamp();
+	XTft_WriteReg(Tft->TftConfig.BaseAddress, XTFT_AR_OFFSET, frame_back);
+	// the old frame is still scanned out until the latch, it cannot be drawn into before that
+	while (XTft_GetVsyncStatus(Tft) != XTFT_IESR_VADDRLATCH_STATUS_MASK)
+	{
+		yield();
+	}
+	now = timestamp();
+	hist_add(&framestats.vsyncwait, timestamp_diff_us(waitstart, now));
+
+	shown = frame_back;
+	frame_back = frame_front;
+	frame_front = shown;
+#if TFT_PALETTE
+	tft_expanddamage(frame_back);
+#else
+	Tft->TftConfig.VideoMemBaseAddr = frame_back;
+
+	if (damage_full == 1)
+	{
+		tft_copyrect(frame_front, frame_back, &whole);
+	}
+	else
+	{
+		for (i = 0; i < damage_count; i++)
+		{
+			tft_copyrect(frame_front, frame_back, &damage[i]);
+		}
+	}
+#endif
+#else
+	now = timestamp();
+#endif
+	damage_count = 0;
+	damage_full = 0;
+
+	if (framestats.presented > 0)
+	{
+		interval = timestamp_diff_us(framestats.last_present, now);
+		hist_add(&framestats.frametime, interval);
+		if (framestats.presented > 1)
+		{
+			hist_add(&framestats.jitter, interval > framestats.last_interval ?
+				interval - framestats.last_interval : framestats.last_interval - interval);
+		}
+		framestats.last_interval = interval;
+	}
+	framestats.last_present = now;
+	framestats.presented++;
+
+	pthread_mutex_unlock(&tft_mutex);
+	return now;
+}
+
+void frame_printstats()
+{
+	pthread_mutex_lock(&uart_mutex);
+	xil_printf("-- frames: presented %d, %d pixels copied between frames, %s buffered --\r\n",
+		framestats.presented, framestats.copied, DOUBLE_BUFFER ? "double" : "single");
+	if (framestats.presented > 0)
+	{
+		xil_printf("  per frame: %d primitives, %d locks, %d pixels covered by primitives, %d written\r\n",
+			framestats.primitives / framestats.presented, framestats.locks / framestats.presented,
+			framestats.drawn / framestats.presented, framestats.written / framestats.presented);
+	}
+	if (framestats.presented > 0)
+	{
+		xil_printf("  HUD: %d pixels per frame in %d glyph cells, %d redrawing whole boxes\r\n",
+			framestats.hudcells * XTFT_CHAR_WIDTH * XTFT_CHAR_HEIGHT / framestats.presented, framestats.hudcells,
+			framestats.hudboxes / framestats.presented);
+	}
+#if DOUBLE_BUFFER
+	xil_printf("  pacing: %d vsyncs missed by ready frames, %d frames merged into a later one\r\n",
+		framestats.missedvsync, framestats.merged);
+#else
+	xil_printf("  pacing: none single buffered, %d frames merged into a later one\r\n", framestats.merged);
+#endif
+#if TFT_TILE_THREADS > 1
+	xil_printf("  tiles: %d areas composed on %d threads\r\n", framestats.tiled, tile_threads);
+#endif
+#if TFT_PALETTE
+	xil_printf("  palette: %d colours, %d pixels expanded to 32 bits\r\n", tft_colours, framestats.expanded);
+#endif
+	hist_print("frame time", &framestats.frametime);
+	hist_print("frame jitter", &framestats.jitter);
+#if DOUBLE_BUFFER
+	hist_print("vsync wait", &framestats.vsyncwait);
+#endif
+	pthread_mutex_unlock(&uart_mutex);
+}
+
+// every slot starts free for the first lap, before anything is posted
+void render_init()
+{
+	int i;
+
+	for (i = 0; i < RENDER_RING_SIZE; i++)
+	{
+		render_ring[i].seq = i;
+	}
+	render_head = 0;
+	render_tail = 0;
+	sem_init(&sem_render, 1, 0);
+}
+
+// claims the next slot of the render ring and fills it, safe from any thread
+// a slot is free for position pos when its seq is pos, a producer claims it by moving
+// render_head past pos, and publishes it by setting seq to pos + 1 once filled
+// when the slot still holds the command from a lap ago the ring is full and the producer yields
+void render_push(render_cmd *cmd)
+{
+	render_cmd *slot;
+	unsigned int pos, seq;
+
+	pos = __atomic_load_n(&render_head, __ATOMIC_RELAXED);
+	while (1)
+	{
+		slot = &render_ring[pos & (RENDER_RING_SIZE - 1)];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos)
+		{
+			// on failure pos is loaded with the head another producer moved it to
+			if (__atomic_compare_exchange_n(&render_head, &pos, pos + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if ((int) (seq - pos) < 0)
+		{
+			__atomic_fetch_add(&renderstats.fullwaits, 1, __ATOMIC_RELAXED);
+			yield();
+			pos = __atomic_load_n(&render_head, __ATOMIC_RELAXED);
+		}
+		else
+		{
+			pos = __atomic_load_n(&render_head, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->op = cmd->op;
+	slot->arg[0] = cmd->arg[0];
+	slot->arg[1] = cmd->arg[1];
+	slot->arg[2] = cmd->arg[2];
+	slot->arg[3] = cmd->arg[3];
+	slot->text = cmd->text;
+	slot->generation = cmd->generation;
+	slot->posted = timestamp();
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	sem_post(&sem_render);
+}
+
+void render_post(int op, int a0, int a1, int a2, int a3, char *text)
+{
+	render_cmd cmd;
+
+	cmd.op = op;
+	cmd.arg[0] = a0;
+	cmd.arg[1] = a1;
+	cmd.arg[2] = a2;
+	cmd.arg[3] = a3;
+	cmd.text = text;
+	cmd.generation = reset_generation;
+	render_push(&cmd);
+}
+
+// a brick or column update, dropped by thread_render if a reset came in between
+void render_brick(msg_col *col)
+{
+	render_cmd cmd;
+
+	cmd.op = RENDER_BRICK;
+	cmd.arg[0] = col->id;
+	cmd.arg[1] = col->row;
+	cmd.arg[2] = col->status;
+	cmd.arg[3] = col->isRed;
+	cmd.text = NULL;
+	cmd.generation = col->generation;
+	render_push(&cmd);
+}
+
+// thread_render only, after sem_render said a command was posted
+// commands are taken in the order their slots were claimed, one claimed and not yet filled is waited for
+void render_take(render_cmd *cmd)
+{
+	render_cmd *slot = &render_ring[render_tail & (RENDER_RING_SIZE - 1)];
+	unsigned int depth;
+
+	while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != render_tail + 1)
+	{
+		yield();
+	}
+	*cmd = *slot;
+	depth = __atomic_load_n(&render_head, __ATOMIC_RELAXED) - render_tail;
+	__atomic_store_n(&slot->seq, render_tail + RENDER_RING_SIZE, __ATOMIC_RELEASE);
+	render_tail++;
+
+	renderstats.taken++;
+	renderstats.depthsum += depth;
+	if (depth > renderstats.maxdepth)
+		renderstats.maxdepth = depth;
+	hist_add(&renderstats.latency, timestamp_diff_us(cmd->posted, timestamp()));
+}
+
+// thread_render only, holding tft_mutex except for RENDER_PRESENT
+void render_run(render_cmd *cmd)
+{
+	unsigned int stage_start;
+
+	switch (cmd->op)
+	{
+	case RENDER_BALL:
+		STAGE_BEGIN(stage_start);
+		drawBall(&TftInstance, cmd->arg[0], cmd->arg[1], &render_ball_x, &render_ball_y);
+		STAGE_END(STAGE_BALLDRAW, stage_start);
+		break;
+	case RENDER_BAR:
+		drawBar(&TftInstance, cmd->arg[0], &render_cursor, render_lengthen, cmd->arg[1]);
+		render_lengthen = cmd->arg[1];
+		break;
+	case RENDER_BRICK:
+		//columns sent before the last reset are already redrawn by RENDER_SCREEN
+		if (cmd->generation != reset_generation)
+		{
+			renderstats.dropped++;
+			break;
+		}
+		STAGE_BEGIN(stage_start);
+		if (cmd->arg[1] != 0)
+			drawBrick(&TftInstance, cmd->arg[1], cmd->arg[0], (cmd->arg[2] >> (cmd->arg[1] - 1)) & 1, cmd->arg[3]);
+		else	// bricks[] as it is now, a hit posted after the column was is already in it
+			drawBCol(&TftInstance, cmd->arg[0], __atomic_load_n(&bricks[cmd->arg[0]-1], __ATOMIC_RELAXED), cmd->arg[3]);
+		STAGE_END(STAGE_BRICKDRAW, stage_start);
+		break;
+	case RENDER_HUD:
+		STAGE_BEGIN(stage_start);
+		hud_number(&TftInstance, cmd->arg[0], cmd->arg[1]);
+		STAGE_END(STAGE_HUDDRAW, stage_start);
+		break;
+	case RENDER_TEXT:
+		XTft_DrawTextBox(&TftInstance, cmd->arg[0], cmd->arg[1], cmd->arg[2], cmd->arg[3], cmd->text);
+		break;
+	case RENDER_RESTORE:
+		tft_restore(&TftInstance, cmd->arg[0], cmd->arg[1], cmd->arg[2], cmd->arg[3]);
+		break;
+	case RENDER_SCREEN:
+		render_screen(&TftInstance, cmd->arg[0], cmd->arg[1]);
+		break;
+	case RENDER_PRESENT:
+		render_present(cmd);
+		break;
+	}
+}
+
+// thread_render only, whether the commands already posted behind the one just taken hold
+// a whole frame, every slot up to its RENDER_PRESENT filled
+int render_presentqueued()
+{
+	render_cmd *slot;
+	unsigned int pos;
+
+	for (pos = render_tail; ; pos++)
+	{
+		slot = &render_ring[pos & (RENDER_RING_SIZE - 1)];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+			return 0;
+		if (slot->op == RENDER_PRESENT)
+			return 1;
+	}
+}
+
+// thread_render only, puts the frame on screen, at the next vsync with DOUBLE_BUFFER
+// a frame posted in time is latched at the first vsync after it, every later one it waited for is missed;
+// single buffered there is no latch to miss, so nothing is counted
+void render_present(render_cmd *cmd)
+{
+	unsigned int ticks = xget_clock_ticks();
+	unsigned int latched;
+	int first = framestats.presented == 0;
+
+	// frames put on screen in the last second
+	if (ticks - render_fpsticks >= 100)
+	{
+		tft_begin();
+		hud_number(&TftInstance, HUD_FPS, framestats.presented - render_fpsframes);
+		tft_end();
+		render_fpsticks = ticks;
+		render_fpsframes = framestats.presented;
+	}
+
+	latched = tft_present(&TftInstance);
+	if (latched == 0)
+		return;
+#if DOUBLE_BUFFER
+	framestats.missedvsync += timestamp_diff_us(cmd->posted, latched) / TFT_REFRESH_US;
+#endif
+
+	if (first)
+	{
+		pthread_mutex_lock(&uart_mutex);
+		xil_printf("boot to first frame: %d us, Tft_init %d us, screen %s in %d us\r\n",
+			timestamp_diff_us(boot_start, latched), boot_tftinit, render_screenloaded ? "copied" : "drawn", render_screentime);
+		pthread_mutex_unlock(&uart_mutex);
+	}
+	if (render_firstframe == 1)
+	{
+		render_firstframe = 0;
+		pthread_mutex_lock(&uart_mutex);
+		xil_printf("reset to first frame: %d us, %d us after the button press, screen %s in %d us\r\n",
+			timestamp_diff_us(render_resetstart, latched), timestamp_diff_us(reset_press_time, latched),
+			render_screenloaded ? "copied" : "drawn", render_screentime);
+		pthread_mutex_unlock(&uart_mutex);
+	}
+}
+
+// the initial game screen, the ball and bar drawn where init_variables put them
+// everything but the crystal bricks, ball and bar is the same on every reset, it is drawn
+// once and kept by render_snapshot, and copied back from there after that
+void render_screen(XTft *Tft, int cursor, int lengthen)
+{
+	unsigned int start = timestamp();
+	tft_rect gamearea = {GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM};
+	int i, j;
+
+	if (snapshot_valid == 1)
+	{
+		tft_loadscreen(Tft, TFT_SNAPSHOT_ADDR, snapshot_rects, snapshot_count);
+		tft_copyrect(TFT_BGSNAPSHOT_ADDR, TFT_BACKGROUND_ADDR, &gamearea);
+		framestats.loaded += (GAMEAREA_RIGHT - GAMEAREA_LEFT + 1) * (GAMEAREA_BTM - GAMEAREA_TOP + 1);
+		memcpy(hud, snapshot_hud, sizeof(hud));
+		render_screenloaded = 1;
+	}
+	else
+	{
+		render_snapshot(Tft);
+		render_screenloaded = 0;
+	}
+
+	// Crystal bricks over the plain ones
+	for(i=1;i< TOTAL_COLUMNS+1 ;i++)
+	{
+		for(j=1;j< TOTAL_ROWS+1 ;j++)
+		{
+			if (crystalcols[i-1] & (1 << (j-1)))
+				drawBrick(Tft, j, i, 1, 0);
+		}
+	}
+
+	// Initial ball
+	XTft_DrawSolidCircle(Tft, INITIAL_X, INITIAL_Y);
+	render_ball_x = INITIAL_X;
+	render_ball_y = INITIAL_Y;
+
+	// Initial bar
+	render_cursor = cursor;
+	render_lengthen = lengthen;
+	drawBar(Tft, cursor, &render_cursor, lengthen, lengthen);
+
+	render_screentime = timestamp_diff_us(start, timestamp());
+}
+
+// draws the part of the initial screen that is the same on every reset, all bricks plain,
+// composes it and keeps what it covers at TFT_SNAPSHOT_ADDR and the game area of the
+// background layer at TFT_BGSNAPSHOT_ADDR
+void render_snapshot(XTft *Tft)
+{
+	tft_rect gamearea = {GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM};
+	unsigned int crystals[TOTAL_COLUMNS];
+	int i;
+
+	tft_bgbox(GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM, GAMEAREA_COLOUR);
+	tft_restore(Tft, GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM);
+	// Draw the box labels
+	XTft_DrawTextBox(Tft, 555, 10, 589, 39, "fps");
+	XTft_DrawTextBox(Tft, 555, 60, 599, 79, "SCORE");
+	XTft_DrawTextBox(Tft, 555, 200, 599, 219, "TIME");
+	XTft_DrawTextBox(Tft, 555, 290, 599, 309, "SPEED");
+	XTft_DrawTextBox(Tft, 555, 380, 609, 399, "BRICKS");
+
+	// Draw the initial values, the boxes are drawn whole again
+	for(i=0;i<HUD_FIELDS;i++)
+	{
+		hud[i].valid = 0;
+	}
+	hud_number(Tft, HUD_FPS, 0);
+	hud_number(Tft, HUD_SCORE, 0);
+	hud_number(Tft, HUD_TIME, 0);
+	hud_number(Tft, HUD_SPEED, INITIAL_BALLSPEED);
+	hud_number(Tft, HUD_BRICKS, 80);
+
+	// Draw bricks, plain, the crystal ones change every reset
+	memcpy(crystals, crystalcols, sizeof(crystals));
+	memset(crystalcols, 0, sizeof(crystals));
+	for(i=1;i< TOTAL_COLUMNS+1 ;i++)
+	{
+		drawBCol(Tft, i, 0xFF, 0);
+	}
+	memcpy(crystalcols, crystals, sizeof(crystals));
+
+	// what is about to be composed is what the snapshot covers
+	if (pending_full == 1)
+	{
+		snapshot_count = 1;
+		snapshot_rects[0].x1 = 0;
+		snapshot_rects[0].y1 = 0;
+		snapshot_rects[0].x2 = DISPLAY_COLUMNS-1;
+		snapshot_rects[0].y2 = DISPLAY_ROWS-1;
+	}
+	else
+	{
+		snapshot_count = pending_count;
+		memcpy(snapshot_rects, pending, pending_count * sizeof(tft_rect));
+	}
+	tft_compose(Tft);
+	for (i = 0; i < snapshot_count; i++)
+	{
+		tft_copyrect(TFT_COMPOSE_ADDR(Tft), TFT_SNAPSHOT_ADDR, &snapshot_rects[i]);
+	}
+	tft_copyrect(TFT_BACKGROUND_ADDR, TFT_BGSNAPSHOT_ADDR, &gamearea);
+	memcpy(snapshot_hud, hud, sizeof(hud));
+	snapshot_valid = 1;
+}
+
+void render_printstats()
+{
+	pthread_mutex_lock(&uart_mutex);
+	xil_printf("-- render ring: %d commands, %d stale bricks dropped, %d posts found it full --\r\n",
+		renderstats.taken, renderstats.dropped, renderstats.fullwaits);
+	if (renderstats.taken > 0)
+	{
+		xil_printf("  queue depth: avg %d max %d of %d\r\n",
+			(unsigned int) (renderstats.depthsum / renderstats.taken), renderstats.maxdepth, RENDER_RING_SIZE);
+	}
+	hist_print("command latency", &renderstats.latency);
+	pthread_mutex_unlock(&uart_mutex);
+}
+
+// the digits are written once with XTft_Write into the top left of TFT_TEXT_ADDR, the
+// background layer unless TFT_PALETTE, which is outside the game area and never copied
+// to the screen, and kept from there
+void hud_init(XTft *Tft)
+{
+	UINTPTR frame = Tft->TftConfig.VideoMemBaseAddr;
+	u32 *src;
+	int i, j, x;
+
+	Tft->TftConfig.VideoMemBaseAddr = TFT_TEXT_ADDR;
+	XTft_SetColor(Tft, TEXT_COLOUR, TEXTBOX_COLOUR);
+	for (i = 0; i < HUD_GLYPHS; i++)
+	{
+		XTft_SetPosChar(Tft, i * XTFT_CHAR_WIDTH, 0);
+		XTft_Write(Tft, i == HUD_BLANK ? ' ' : '0' + i);
+
+		src = (u32 *) TFT_TEXT_ADDR + i * XTFT_CHAR_WIDTH;
+		for (j = 0; j < XTFT_CHAR_HEIGHT; j++, src += XTFT_DISPLAY_BUFFER_WIDTH)
+		{
+			for (x = 0; x < XTFT_CHAR_WIDTH; x++)
+			{
+				glyph_pixels[i][j * XTFT_CHAR_WIDTH + x] = tft_colour(src[x]);
+			}
+		}
+		glyph_sprite[i].width = XTFT_CHAR_WIDTH;
+		glyph_sprite[i].height = XTFT_CHAR_HEIGHT;
+		glyph_sprite[i].pixels = glyph_pixels[i];
+		sprite_extents(&glyph_sprite[i]);
+	}
+	Tft->TftConfig.VideoMemBaseAddr = frame;
+}
+
+// draws the number where XTft_DrawNumberBox would, but only the character cells that differ from what is shown
+void hud_number(XTft *Tft, int field, int number)
+{
+	hud_field *f = &hud[field];
+	char text[12] = "";
+	int i, len, shownlen;
+
+	numbertocstring(number, text);
+	if (f->valid == 1 && strcmp(text, f->shown) == 0)
+		return;
+	framestats.hudboxes += (f->box.x2 - f->box.x1 + 1) * (f->box.y2 - f->box.y1 + 1);
+	if (f->valid == 0)
+	{
+		XTft_DrawSolidBox(Tft, f->box.x1, f->box.y1, f->box.x2, f->box.y2, TEXTBOX_COLOUR);
+		f->shown[0] = '\0';
+		f->valid = 1;
+	}
+
+	len = strlen(text);
+	shownlen = strlen(f->shown);
+	for (i = 0; i < len || i < shownlen; i++)
+	{
+		if (i < len && i < shownlen && text[i] == f->shown[i])
+			continue;
+		tft_drawglyph(Tft, i < len && text[i] >= '0' && text[i] <= '9' ? text[i] - '0' : HUD_BLANK, f->box.x1 + 3 + i * XTFT_CHAR_WIDTH, f->box.y1 + 5);
+		framestats.hudcells++;
+	}
+	strcpy(f->shown, text);
+}
+
+void XTft_DrawTextBox(XTft *Tft, int x1, int y1, int x2, int y2, char* cstringtext)
+{
+	char* txtptr = cstringtext;
+	int cstringleng = 0;
+	tft_drawcmd cmd;
+
+	// Check cstringtext ends with a NULL
+	while(*txtptr != '\0')
+	{
+		txtptr++;
+		cstringleng++;
+		if (cstringleng > 10)	//do not expect cstringtext to be longer than 9 chars
+		return;
+	}
+	if (cstringleng==0) 	//stop printing if cstringtext is empty
+	return;
+	else 	// move txtptr back to start of cstringtext
+	txtptr = cstringtext;
+
+	//draw bgbox first - also help to erase previous info
+	XTft_DrawSolidBox(Tft, x1, y1, x2, y2, TEXTBOX_COLOUR);
+
+	// draw text after that
+	cmd.op = DRAWCMD_TEXT;
+	cmd.rect.x1 = x1 + 3;
+	cmd.rect.y1 = y1 + 5;
+	cmd.rect.x2 = x1 + 3 + cstringleng * XTFT_CHAR_WIDTH - 1;
+	cmd.rect.y2 = y1 + 5 + XTFT_CHAR_HEIGHT - 1;
+	if (cmd.rect.x2 > DISPLAY_COLUMNS-1 || cmd.rect.y2 > DISPLAY_ROWS-1)
+		return;
+	cmd.col = TEXT_COLOUR;
+	cmd.x = x1 + 3;
+	cmd.y = y1 + 5;
+	strcpy(cmd.text, cstringtext);
+	tft_record(Tft, &cmd);
+
+}
+
+void XTft_DrawNumberBox(XTft *Tft, int x1, int y1, int x2, int y2, int someNumber)
+{
+	char txtbuffer[10] = "";
+	numbertocstring(someNumber, txtbuffer);
+	XTft_DrawTextBox(Tft, x1, y1, x2, y2, txtbuffer);
+}
+
+void numbertocstring(int num, char* charptr)
+{
+	int reversednum = 0;
+	int digitcount = 0;
+
+	if (num == 0)
+	{
+		*charptr = 48;
+		charptr++;
+		*charptr = '\0';
+		return;
+	}
+
+	while (num != 0)
+	{
+		reversednum = reversednum * 10;
+		reversednum = reversednum + num % 10;
+		num = num / 10;
+		digitcount++;
+	}
+	while(digitcount!=0)
+	{
+		*charptr = (reversednum % 10) + 48;  //convert digit to its corresponding ascii
+		reversednum =  reversednum/ 10;
+		charptr++;
+		digitcount--;
+	}
+	*charptr = '\0';     // terminates with null
+}
+
+int generatebitmask(int brickrow)
+{
+	//debug
+	// use
+	//int bitmask = 1 << brickrow;	//bitshift
+	//return !bitmask;	//invert
+	switch(brickrow)
+	{
+		case 1:
+		return 0xfe;
+		case 2:
+		return 0xfd;
+		case 3:
+		return 0xfb;
+		case 4:
+		return 0xf7;
+		case 5:
+		return 0xef;
+		case 6:
+		return 0xdf;
+		case 7:
+		return 0xbf;
+		case 8:
+		return 0x7f;
+		default:
+		return 0xff;
+	}
+}
+
+// two-phase reset, run by the game thread
+// phase 1: ball is told to reset and the game is rebuilt in place while ball does the same
+// phase 2: once ball has answered GAME_READY the other threads carry on and ball is told to start,
+// its next update is the first frame of the new game
+void game_reset()
+{
+	msg_any msg_recd;
+
+	mbox_send_control(GAME_RESET);
+
+	//waits for whichever thread is drawing to finish, none starts again until unlocked
+	pthread_mutex_lock(&reset_mutex);
+	reset_generation++;
+	init_variables();
+	init_screen();
+
+	//level ups that were never taken are dropped, thread_red is held off until the new red columns are picked
+	__atomic_store_n(&red_levelups, 0, __ATOMIC_RELAXED);
+	red_start();
+	pthread_mutex_unlock(&reset_mutex);
+
+	//anything ball sent before it saw the reset is dropped
+	while(mbox_wait(&msg_recd) != CHANNEL_CONTROL || msg_recd.control.game_status != GAME_READY);
+
+	game_transition(GAME_MASK(GAME_RESET), GAME_NORMAL);	//held at GAME_RESET until ball is ready
+	mbox_send_control(GAME_NORMAL);
+}
+
+// the only writer of the game state: changes it to to if it is one of the states in from,
+// deciding and changing in one hold of gamestate_mutex, and wakes every thread blocked in
+// game_wait to look at it
+// returns 1 if it changed, 0 if the state was not in from and is left as it is
+int game_transition(unsigned int from, int to)
+{
+	int i;
+
+	pthread_mutex_lock(&gamestate_mutex);
+	if ((GAME_MASK(gameview.state) & from) == 0)
+	{
+		pthread_mutex_unlock(&gamestate_mutex);
+		return 0;
+	}
+	view_lock();
+	gameview.state = to;
+	view_unlock();
+	for (i = 0; i < GAME_WAITERS; i++)
+	{
+		if (gamestate_waiting[i] == 1)
+		{
+			gamestate_waiting[i] = 0;
+			sem_post(&sem_gamestate[i]);
+		}
+	}
+	pthread_mutex_unlock(&gamestate_mutex);
+	return 1;
+}
+
+// moves the held ball with the bar, only while the state is still GAME_BALLHELD so it cannot
+// overwrite a position thread_game has taken back
+void game_moveheldball(int dx)
+{
+	pthread_mutex_lock(&gamestate_mutex);
+	if (gameview.state == GAME_BALLHELD)
+	{
+		ball_drawn_x = ball_drawn_x + dx;
+		render_post(RENDER_BALL, ball_drawn_x, ball_drawn_y, 0, 0, NULL);
+	}
+	pthread_mutex_unlock(&gamestate_mutex);
+}
+
+// blocks until the game state is one of the states in mask and returns it
+// waiter is the caller's own semaphore, it is posted at most once per wait
+// the state only changes under gamestate_mutex, so it is read here without gameview's sequence
+int game_wait(int waiter, unsigned int mask)
+{
+	int state;
+
+	pthread_mutex_lock(&gamestate_mutex);
+	while ((GAME_MASK(gameview.state) & mask) == 0)
+	{
+		gamestate_waiting[waiter] = 1;
+		pthread_mutex_unlock(&gamestate_mutex);
+		sem_wait(&sem_gamestate[waiter]);
+		pthread_mutex_lock(&gamestate_mutex);
+	}
+	state = gameview.state;
+	pthread_mutex_unlock(&gamestate_mutex);
+	return state;
+}
+
+// the transitions a press makes, run by thread_buttons
+// NORMAL: centre pauses, top resets; PAUSE: centre resumes, top resets
+// LOSE/WIN: top resets; BALLHELD: bottom lets go of the ball; RESET: ignored
+// the bar buttons are handled by gpPBIntHandler itself
+void game_press(unsigned char val, unsigned int time)
+{
+	if (val == BTN_TOP)
+	{
+		if (game_transition(GAME_MASK(GAME_NORMAL) | GAME_MASK(GAME_PAUSE) | GAME_MASK(GAME_LOSE) | GAME_MASK(GAME_WIN), GAME_RESET))
+		{
+			reset_press_time = time;	// read by thread_render once the reset has been drawn
+		}
+	}
+	else if (val == BTN_CENTER)
+	{
+		if (game_transition(GAME_MASK(GAME_NORMAL), GAME_PAUSE) == 0)
+		{
+			game_transition(GAME_MASK(GAME_PAUSE), GAME_NORMAL);
+		}
+	}
+	else if (val == BTN_BTM)
+	{
+		game_transition(GAME_MASK(GAME_BALLHELD), GAME_NORMAL);
+	}
+}
+
+// deferred half of gpPBIntHandler, sleeps until a press is queued
+void* thread_buttons()
+{
+	while(1)
+	{
+		sem_wait(&sem_buttons);
+		game_press(button_val[button_tail % BUTTON_RING], button_time[button_tail % BUTTON_RING]);
+		button_tail++;
+	}
+}
+
+// publishes the bar position for ball to pick up at its next physics step
+// called by a gameview writer, the isr or a thread holding view_lock
+void paddle_publish(int cursor)
+{
+	unsigned int now = timestamp();
+
+	gameview.cursor = cursor;
+	gameview.input_time = now;
+	paddle_seq++;
+
+	// the user register of a mutex can only be written by the processor holding it, ball never locks these
+	XMutex_Lock(&mutex, PADDLE_TIME_MUTEX_NUM);
+	XMutex_SetUser(&mutex, PADDLE_TIME_MUTEX_NUM, now);
+	XMutex_Unlock(&mutex, PADDLE_TIME_MUTEX_NUM);
+	XMutex_Lock(&mutex, PADDLE_MUTEX_NUM);
+	XMutex_SetUser(&mutex, PADDLE_MUTEX_NUM, PADDLE_WORD(cursor, paddle_seq));
+	XMutex_Unlock(&mutex, PADDLE_MUTEX_NUM);
+}
+
+// the sequence is odd from view_begin to view_end, a reader that saw it odd or changed
+// across its copy tries again
+void view_begin()
+{
+	__atomic_store_n(&view_seq, view_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void view_end()
+{
+	__atomic_store_n(&view_seq, view_seq + 1, __ATOMIC_RELEASE);
+}
+
+// makes the calling thread gameview's only writer, the isr is held off until view_unlock
+// the hw mutex behind paddle_publish is owned by the processor, not the thread, so this also
+// keeps the isr from getting in between
+void view_lock()
+{
+	pthread_mutex_lock(&view_mutex);
+	disable_interrupt(XPAR_MICROBLAZE_0_AXI_INTC_AXI_GPIO_0_IP2INTC_IRPT_INTR);
+	view_begin();
+}
+
+void view_unlock()
+{
+	view_end();
+	enable_interrupt(XPAR_MICROBLAZE_0_AXI_INTC_AXI_GPIO_0_IP2INTC_IRPT_INTR);
+	pthread_mutex_unlock(&view_mutex);
+}
+
+// a consistent copy of gameview, for threads, the isr reads it in place
+// only a writer preempted half way leaves the sequence odd for long, the reader then waits on
+// view_mutex so that the writer can finish whatever its priority
+void view_read(game_view *copy)
+{
+	unsigned int seq;
+
+	while (1)
+	{
+		seq = __atomic_load_n(&view_seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+		{
+			pthread_mutex_lock(&view_mutex);
+			pthread_mutex_unlock(&view_mutex);
+			continue;
+		}
+		*copy = gameview;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&view_seq, __ATOMIC_RELAXED) == seq)
+			return;
+	}
+}
+
+//
+//	Mailbox Functions
+//
+
+void timer_init()
+{
+#ifdef XPAR_TMRCTR_0_DEVICE_ID
+	XTmrCtr_Initialize(&Timer, TIMER_DEVICE_ID);
+	XTmrCtr_SetOptions(&Timer, 0, XTC_AUTO_RELOAD_OPTION);
+	XTmrCtr_Start(&Timer, 0);
+#endif
+}
+
+// raw timer counts, wraps around
+unsigned int timestamp()
+{
+#ifdef XPAR_TMRCTR_0_DEVICE_ID
+	return XTmrCtr_GetValue(&Timer, 0);
+#else
+	return xget_clock_ticks() * 10000;
+#endif
+}
+
+unsigned int timestamp_diff_us(unsigned int from, unsigned int to)
+{
+	return (to - from) / TIMER_COUNTS_PER_US;	// unsigned subtraction handles the wrap around
+}
+
+void mbox_send(msg_header *header, size_t msgsize, int type, int channel)
+{
+	// more than one thread sends, a message has to go into the fifo in one piece
+	pthread_mutex_lock(&mbox_mutex);
+	header->type = type;
+	header->channel = channel;
+	header->size = msgsize;
+	header->seq = mboxstats.sent;
+	header->echo = mboxstats.last_timestamp;
+	header->timestamp = timestamp();
+	XMbox_WriteBlocking(&Mbox, (u32 *) header, msgsize);
+	mboxstats.sent++;
+	pthread_mutex_unlock(&mbox_mutex);
+}
+
+void mbox_send_control(int game_status)
+{
+	msg_control msg_control_tosend;
+
+	msg_control_tosend.game_status = game_status;
+	mbox_send(&msg_control_tosend.header, sizeof(msg_control), MSG_TYPE_CONTROL, CHANNEL_CONTROL);
+}
+
+void mbox_send_event(int event, int arg)
+{
+	msg_event msg_event_tosend;
+
+	msg_event_tosend.event = event;
+	msg_event_tosend.arg = arg;
+	mbox_send(&msg_event_tosend.header, sizeof(msg_event), MSG_TYPE_EVENT, CHANNEL_EVENT);
+}
+
+// a header the rest of its message can be read after: known type and channel, and a size
+// XMbox_ReadBlocking takes, whole words from the header up to the largest message
+int mbox_headerok(msg_header *header)
+{
+	return header->type >= MSG_TYPE_BALL && header->type <= MSG_TYPE_EVENT &&
+		header->channel >= 0 && header->channel < NUM_CHANNELS &&
+		header->size >= (int) sizeof(msg_header) && header->size <= (int) sizeof(msg_any) &&
+		header->size % 4 == 0;
+}
+
+// reads the next message off the fifo, whatever its type
+// after a bad header the length of the rest is unknown and the fifo is out of step, so words
+// are dropped one at a time until the ones at the front read as a header again
+// returns its channel
+int mbox_receive(msg_any *msg)
+{
+	u32 *words = (u32 *) &msg->header;
+	unsigned int now;
+	int seqdiff;
+	int channel;
+	int i;
+
+	XMbox_ReadBlocking(&Mbox, words, sizeof(msg_header));
+	if (mbox_headerok(&msg->header) == 0)
+	{
+		mboxstats.misrouted++;
+		XMutex_Lock(&mutex, MUTEX_NUM);
+		xil_printf("-- Error - GAME got a bad header: type %d channel %d size %d, seq %d, resyncing --\r\n",
+			msg->header.type, msg->header.channel, msg->header.size, msg->header.seq);
+		XMutex_Unlock(&mutex, MUTEX_NUM);
+		do
+		{
+			for (i = 0; i < (int) (sizeof(msg_header) / 4) - 1; i++)
+			{
+				words[i] = words[i + 1];
+			}
+			XMbox_ReadBlocking(&Mbox, &words[i], 4);
+			mboxstats.skipped++;
+		} while (mbox_headerok(&msg->header) == 0);
+	}
+	now = timestamp();
+	mboxstats.received++;
+
+	if (msg->header.size > (int) sizeof(msg_header))
+	{
+		XMbox_ReadBlocking(&Mbox, (u32 *) (&msg->header + 1), msg->header.size - sizeof(msg_header));
+	}
+
+	channel = msg->header.channel;
+	mboxstats.channel_received[channel]++;
+
+	seqdiff = (int) (msg->header.seq - mboxstats.expected_seq);
+	if (seqdiff > 0)
+	{
+		mboxstats.gaps += seqdiff;
+	}
+	if (seqdiff < 0)
+	{
+		mboxstats.reordered++;
+	}
+	else
+	{
+		mboxstats.expected_seq = msg->header.seq + 1;
+	}
+
+	hist_add(&mboxstats.oneway, timestamp_diff_us(msg->header.timestamp, now));
+	if (msg->header.echo != 0)
+	{
+		hist_add(&mboxstats.roundtrip, timestamp_diff_us(msg->header.echo, now));
+	}
+	mboxstats.last_timestamp = msg->header.timestamp;
+
+	return channel;
+}
+
+// blocks until the dispatcher has queued a message on any channel
+// control is taken first, then events, then state, so a pause or reset never waits behind frames
+// returns the channel the message came from
+int mbox_wait(msg_any *msg)
+{
+	int channel;
+	int msgid;
+
+	sem_wait(&sem_inbox);	// posted once per queued message, so one of the queues has something
+	for (channel = 0; channel < NUM_CHANNELS; channel++)
+	{
+		msgid = msgget(CHANNEL_Q + channel, IPC_CREAT);
+		if (msgrcv(msgid, msg, sizeof(msg_any), 0, IPC_NOWAIT) == sizeof(msg_any))
+		{
+			return channel;
+		}
+	}
+	return -1;
+}
+
+void mbox_printstats(char *side)
+{
+	pthread_mutex_lock(&uart_mutex);
+	XMutex_Lock(&mutex, MUTEX_NUM);
+	xil_printf("-- %s mailbox: sent %d received %d gaps %d reordered %d misrouted %d (%d words skipped) --\r\n", side,
+		mboxstats.sent, mboxstats.received, mboxstats.gaps, mboxstats.reordered, mboxstats.misrouted, mboxstats.skipped);
+	xil_printf("  by channel: control %d event %d state %d\r\n", mboxstats.channel_received[CHANNEL_CONTROL],
+		mboxstats.channel_received[CHANNEL_EVENT], mboxstats.channel_received[CHANNEL_STATE]);
+	hist_print("one-way", &mboxstats.oneway);
+	hist_print("round-trip", &mboxstats.roundtrip);
+	XMutex_Unlock(&mutex, MUTEX_NUM);
+	pthread_mutex_unlock(&uart_mutex);
+}
+
+void hist_add(latency_hist *hist, unsigned int us)
+{
+	int i = 0;
+
+	while ((us >> (i + 1)) != 0 && i < HIST_BUCKETS - 1)
+	{
+		i++;
+	}
+	hist->bucket[i]++;
+
+	if (hist->count == 0 || us < hist->min)
+		hist->min = us;
+	if (us > hist->max)
+		hist->max = us;
+	hist->sum += us;
+	hist->count++;
+}
+
+// nanoseconds in bucket STAGE_SUB * (e - 2) + the 3 bits below the top one for
+// 2^e <= ns < 2^(e+1), the ones below STAGE_SUB ns have a bucket each
+int stage_bucket(unsigned int ns)
+{
+	int e = 31;
+
+	if (ns < STAGE_SUB)
+		return ns;
+	while ((ns >> e) == 0)
+		e--;
+	return STAGE_SUB * (e - 2) + ((ns >> (e - 3)) & (STAGE_SUB - 1));
+}
+
+// the largest ns that falls into the bucket
+unsigned int stage_bucketmax(int bucket)
+{
+	int e = bucket / STAGE_SUB + 2;
+
+	if (bucket < STAGE_SUB)
+		return bucket;
+	return (((unsigned int) (STAGE_SUB + bucket % STAGE_SUB + 1)) << (e - 3)) - 1;
+}
+
+// timer counts since a STAGE_BEGIN, kept in ns
+void stage_add(int stage, unsigned int counts)
+{
+	stage_hist *hist = &stages[stage];
+	unsigned long long wide = (unsigned long long) counts * 1000 / TIMER_COUNTS_PER_US;
+	unsigned int ns = wide > 0xffffffffULL ? 0xffffffff : (unsigned int) wide;	// a paused game waits longer than 4s
+
+	hist->bucket[stage_bucket(ns)]++;
+	if (ns > hist->max)
+		hist->max = ns;
+	hist->sum += ns;
+	hist->count++;
+}
+
+// an upper bound on the percent-th percentile, within 1/STAGE_SUB of it
+unsigned int stage_percentile(stage_hist *hist, int percent)
+{
+	unsigned long long rank = ((unsigned long long) hist->count * percent + 99) / 100;
+	unsigned long long seen = 0;
+	int i;
+
+	for (i = 0; i < STAGE_BUCKETS; i++)
+	{
+		seen += hist->bucket[i];
+		if (seen >= rank)
+			return stage_bucketmax(i) < hist->max ? stage_bucketmax(i) : hist->max;
+	}
+	return hist->max;
+}
+
+// p50 and p99 of every stage since the last call, which starts them over
+// a stage added to while this runs may lose that sample
+void stage_printstats()
+{
+#if STAGE_TIMING
+	stage_hist *hist;
+	int i;
+#endif
+
+	pthread_mutex_lock(&uart_mutex);
+#if STAGE_TIMING
+	xil_printf("-- stages, ns --\r\n");
+	for (i = 0; i < NUM_STAGES; i++)
+	{
+		hist = &stages[i];
+		if (hist->count == 0)
+		{
+			xil_printf("  %s: no samples\r\n", stage_names[i]);
+			continue;
+		}
+		xil_printf("  %s: n %d p50 %d p99 %d max %d avg %d\r\n", stage_names[i], hist->count,
+			stage_percentile(hist, 50), stage_percentile(hist, 99), hist->max, (unsigned int) (hist->sum / hist->count));
+		memset(hist, 0, sizeof(stage_hist));
+	}
+#else
+	xil_printf("-- stages: built with STAGE_TIMING 0 --\r\n");
+#endif
+	pthread_mutex_unlock(&uart_mutex);
+}
+
+void hist_print(char *name, latency_hist *hist)
+{
+	int i;
+
+	if (hist->count == 0)
+	{
+		xil_printf("  %s: no samples\r\n", name);
+		return;
+	}
+
+	xil_printf("  %s: n %d min %d avg %d max %d us\r\n", name,
+		hist->count, hist->min, (unsigned int) (hist->sum / hist->count), hist->max);
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		if (hist->bucket[i] == 0)
+			continue;
+		if (i == HIST_BUCKETS - 1)
+			xil_printf("   >= %d us : %d\r\n", 1 << i, hist->bucket[i]);
+		else
+			xil_printf("    < %d us : %d\r\n", 1 << (i + 1), hist->bucket[i]);
 	}
 }
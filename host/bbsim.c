@@ -0,0 +1,53 @@
+/*
+ * Runs the host build of the game and ball processors side by side.
+ *
+ *	bbsim [seconds] [game binary] [ball binary]
+ *
+ * Clears the shared mailbox segment, starts both processes with
+ * BB_SIM_SECONDS set so they print their reports and exit together, and
+ * waits for them. Every other BB_* variable is passed through untouched.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static pid_t launch(const char *binary)
+{
+	pid_t pid = fork();
+
+	if (pid == 0)
+	{
+		execl(binary, binary, (char *) NULL);
+		perror(binary);
+		_exit(127);
+	}
+	return pid;
+}
+
+int main(int argc, char **argv)
+{
+	const char *seconds = argc > 1 ? argv[1] : "10";
+	const char *game = argc > 2 ? argv[2] : "./bb_game";
+	const char *ball = argc > 3 ? argv[3] : "./bb_ball";
+	const char *shm = getenv("BB_SHM");
+	pid_t game_pid, ball_pid;
+	int status, failed = 0;
+
+	shm_unlink(shm != NULL ? shm : "/brickbreak");
+	setenv("BB_SIM_SECONDS", seconds, 1);
+
+	// ball first, it is the one that sends the first message
+	ball_pid = launch(ball);
+	game_pid = launch(game);
+
+	if (waitpid(game_pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		failed = 1;
+	if (waitpid(ball_pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		failed = 1;
+
+	shm_unlink(shm != NULL ? shm : "/brickbreak");
+	return failed;
+}
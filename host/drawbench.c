@@ -0,0 +1,278 @@
+/*
+ * Microbenchmarks of the game processor's drawing functions.
+ *
+ *	drawbench [mpixels]
+ *
+ * Links against game_receiver.c built with -Dmain=receiver_main, like
+ * renderbench. Each case calls one drawing function the way thread_render
+ * does, between tft_begin and tft_end, and composes what it recorded into
+ * the frame, so a call is everything it costs to get its pixels into video
+ * memory. The screen case is the whole initial screen init_screen posts,
+ * drawn by render_screen, which after the first call copies it from the
+ * snapshot the first one kept. Every case runs for about mpixels million
+ * pixels (default 200) after a few calls to warm up.
+ *
+ * The results are printed as JSON on stdout, one object per case with the
+ * calls made, ns per call, the pixels the primitives covered and the
+ * pixels written per call, the snapshot copies render_screen makes
+ * included, millions of pixels written per second and, when
+ * perf_event_open is allowed, hardware cache misses per call (null when it
+ * is not). Comparing two runs shows what a change to the renderer did.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "xparameters.h"
+#include "xtft.h"
+#include "../frame_stats.h"
+
+#define TFT_FRAME_ADDR 0x10000000
+#define GAMEAREA_LEFT 60
+#define GAMEAREA_TOP 60
+#define GAMEAREA_RIGHT 514
+#define GAMEAREA_BTM 419
+#define GAMEAREA_COLOUR 0x0000ff00
+#define CIRCLE_RADIUS 7
+#define HALFBARLENG 40
+#define CURSOR_LEFTX 61
+#define CURSOR_RIGHTX 513
+#define TOTAL_COLUMNS 10
+#define TOTAL_ROWS 8
+#define HUD_SCORE 1
+#define WARMUP_CALLS 16
+
+// from game_receiver.c
+typedef struct tft_pattern tft_pattern;
+extern tft_pattern stripe_pattern;
+extern pthread_mutex_t tft_mutex;
+int XTft_DrawSolidBox(XTft *Tft, int x1, int y1, int x2, int y2, unsigned int col);
+int XTft_DrawPattern(XTft *Tft, int x1, int y1, int x2, int y2, tft_pattern *pattern);
+void XTft_DrawSolidCircle(XTft *Tft, int x, int y);
+void XTft_DrawTextBox(XTft *Tft, int x1, int y1, int x2, int y2, char* cstringtext);
+void XTft_DrawNumberBox(XTft *Tft, int x1, int y1, int x2, int y2, int someNumber);
+void drawBall(XTft *Tft, int x, int y, int* ball_ptr_x, int* ball_ptr_y);
+void drawBar(XTft *Tft, int cursor, int* cursor_drawn_ptr, int poweruplengthen_last, int lengthen);
+void drawBCol(XTft *Tft, int bcol_id, int bcol_status, int bcol_isRed);
+void drawBrick(XTft *Tft, int row, int col, int alive, int isRed);
+void hud_init(XTft *Tft);
+void hud_number(XTft *Tft, int field, int number);
+void render_screen(XTft *Tft, int cursor, int lengthen);
+void tft_begin();
+void tft_end();
+void tft_compose(XTft *Tft);
+void sprite_init();
+void tft_bgbox(int x1, int y1, int x2, int y2, unsigned int col);
+
+typedef struct {
+	const char *name;
+	long pixels;				// about what one call covers, sizes the run
+	void (*draw)(long n);		// the n-th call, between tft_begin and tft_end
+} bench_case;
+
+static XTft Tft;
+static int ball_x, ball_y, bar_drawn;
+
+static double now_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void draw_box_gamearea(long n)
+{
+	XTft_DrawSolidBox(&Tft, GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM, (u32) n);
+}
+
+static void draw_box_brick(long n)
+{
+	XTft_DrawSolidBox(&Tft, 65, 65, 105, 80, (u32) n);
+}
+
+static void draw_pattern_brick(long n)
+{
+	(void) n;
+	XTft_DrawPattern(&Tft, 110, 105, 150, 120, &stripe_pattern);
+}
+
+static void draw_pattern_large(long n)
+{
+	(void) n;
+	XTft_DrawPattern(&Tft, 100, 100, 399, 299, &stripe_pattern);
+}
+
+static void draw_circle(long n)
+{
+	XTft_DrawSolidCircle(&Tft, 100 + (int) (n & 255), 300);
+}
+
+static void draw_textbox(long n)
+{
+	(void) n;
+	XTft_DrawTextBox(&Tft, 555, 60, 599, 79, "SCORE");
+}
+
+static void draw_numberbox(long n)
+{
+	XTft_DrawNumberBox(&Tft, 535, 240, 629, 269, (int) (n % 1000));
+}
+
+static void draw_hud(long n)
+{
+	hud_number(&Tft, HUD_SCORE, (int) (n % 1000));
+}
+
+// 5 pixels along each axis per call, bouncing in the game area
+static void draw_ball(long n)
+{
+	int w = GAMEAREA_RIGHT - GAMEAREA_LEFT - 2 * CIRCLE_RADIUS;
+	int h = GAMEAREA_BTM - GAMEAREA_TOP - 2 * CIRCLE_RADIUS;
+	long tx = (n * 5) % (2 * w);
+	long ty = (n * 5) % (2 * h);
+
+	drawBall(&Tft, GAMEAREA_LEFT + CIRCLE_RADIUS + (int) (tx < w ? tx : 2 * w - tx),
+		GAMEAREA_TOP + CIRCLE_RADIUS + (int) (ty < h ? ty : 2 * h - ty), &ball_x, &ball_y);
+}
+
+// 8 pixels per call, as thread_bar moves it while a button is held
+static void draw_bar(long n)
+{
+	int w = CURSOR_RIGHTX - CURSOR_LEFTX - 2 * HALFBARLENG;
+	long t = (n * 8) % (2 * w);
+
+	drawBar(&Tft, CURSOR_LEFTX + HALFBARLENG + (int) (t < w ? t : 2 * w - t), &bar_drawn, 0, 0);
+}
+
+static void draw_bcol(long n)
+{
+	drawBCol(&Tft, (int) (n % TOTAL_COLUMNS) + 1, 0xff, (int) (n / TOTAL_COLUMNS) & 1);
+}
+
+static void draw_brick(long n)
+{
+	drawBrick(&Tft, (int) (n % TOTAL_ROWS) + 1, (int) (n / TOTAL_ROWS % TOTAL_COLUMNS) + 1, (int) (n / (TOTAL_ROWS * TOTAL_COLUMNS)) & 1, 0);
+}
+
+static void draw_screen(long n)
+{
+	(void) n;
+	render_screen(&Tft, 288, 0);
+}
+
+static bench_case cases[] = {
+	{ "solid_box_gamearea", 455 * 360, draw_box_gamearea },
+	{ "solid_box_brick", 41 * 16, draw_box_brick },
+	{ "pattern_brick", 41 * 16, draw_pattern_brick },
+	{ "pattern_large", 300 * 200, draw_pattern_large },
+	{ "solid_circle", 149, draw_circle },
+	{ "text_box", 45 * 20, draw_textbox },
+	{ "number_box", 95 * 30, draw_numberbox },
+	{ "hud_number", 3 * 8 * 12, draw_hud },
+	{ "draw_ball", 2 * 149, draw_ball },
+	{ "draw_bar", 2 * 80 * 5, draw_bar },
+	{ "draw_bcol", 8 * 41 * 16, draw_bcol },
+	{ "draw_brick", 41 * 16, draw_brick },
+	{ "init_screen", 455 * 360 + 5 * 95 * 30, draw_screen },
+};
+
+// hardware cache misses of this thread, -1 if perf_event_open is not allowed here
+static int perf_open()
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void run_case(bench_case *c, double budget, int perf_fd, int last)
+{
+	long calls = (long) (budget / c->pixels) + 1;
+	long n;
+	unsigned int drawn, written;	// written counts the snapshot copies too
+	long long misses = 0;
+	double start, seconds;
+
+	for (n = 0; n < WARMUP_CALLS; n++)
+	{
+		tft_begin();
+		c->draw(n);
+		tft_compose(&Tft);
+		tft_end();
+	}
+
+	drawn = framestats.drawn;
+	written = framestats.written + framestats.loaded;
+	if (perf_fd >= 0)
+	{
+		ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	start = now_seconds();
+	for (n = WARMUP_CALLS; n < WARMUP_CALLS + calls; n++)
+	{
+		tft_begin();
+		c->draw(n);
+		tft_compose(&Tft);
+		tft_end();
+	}
+	seconds = now_seconds() - start;
+	if (perf_fd >= 0)
+	{
+		ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(perf_fd, &misses, sizeof(misses)) != sizeof(misses))
+			misses = 0;
+	}
+	drawn = framestats.drawn - drawn;
+	written = framestats.written + framestats.loaded - written;
+
+	printf("    {\"name\": \"%s\", \"calls\": %ld, \"ns_per_call\": %.1f, \"drawn_per_call\": %.1f, "
+		"\"written_per_call\": %.1f, \"mpixels_per_s\": %.1f, ",
+		c->name, calls, seconds / calls * 1e9, (double) drawn / calls, (double) written / calls, written / seconds / 1e6);
+	if (perf_fd >= 0)
+		printf("\"cache_misses_per_call\": %.2f}%s\n", (double) misses / calls, last ? "" : ",");
+	else
+		printf("\"cache_misses_per_call\": null}%s\n", last ? "" : ",");
+}
+
+int main(int argc, char **argv)
+{
+	double mpixels = argc > 1 ? atof(argv[1]) : 200;
+	int count = (int) (sizeof(cases) / sizeof(cases[0]));
+	int perf_fd, i;
+
+	XTft_CfgInitialize(&Tft, XTft_LookupConfig(XPAR_TFT_0_DEVICE_ID), XPAR_TFT_0_BASEADDR);
+	XTft_SetFrameBaseAddr(&Tft, TFT_FRAME_ADDR);
+	pthread_mutex_init(&tft_mutex, NULL);
+	sprite_init();
+	hud_init(&Tft);
+	tft_bgbox(GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM, GAMEAREA_COLOUR);
+	ball_x = GAMEAREA_LEFT + CIRCLE_RADIUS, ball_y = GAMEAREA_TOP + CIRCLE_RADIUS;
+	bar_drawn = CURSOR_LEFTX + HALFBARLENG;
+	perf_fd = perf_open();
+
+	printf("{\n  \"bench\": \"drawbench\",\n  \"mpixels\": %.1f,\n  \"perf\": %s,\n  \"cases\": [\n",
+		mpixels, perf_fd >= 0 ? "true" : "false");
+	for (i = 0; i < count; i++)
+	{
+		run_case(&cases[i], mpixels * 1e6, perf_fd, i == count - 1);
+	}
+	printf("  ]\n}\n");
+
+	if (perf_fd >= 0)
+		close(perf_fd);
+	return 0;
+}
@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for xilkernel's sys/init.h
+ */
+#ifndef SYS_INIT_H
+#define SYS_INIT_H
+
+void xilkernel_init();
+void xilkernel_start();
+void xilkernel_main();
+int xmk_add_static_thread(int (*start_func)(void), int sched_priority);
+
+#endif
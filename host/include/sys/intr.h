@@ -0,0 +1,19 @@
+/*
+ * Host stand-in for xilkernel's sys/intr.h. Handlers run on a host thread,
+ * one at a time, the way the interrupt controller would serialise them.
+ */
+#ifndef SYS_INTR_H
+#define SYS_INTR_H
+
+typedef void (*XInterruptHandler)(void *arg);
+
+unsigned int register_int_handler(int id, void (*handler)(void *), void *callback);
+void unregister_int_handler(int id);
+void enable_interrupt(int id);
+void disable_interrupt(int id);
+void acknowledge_interrupt(int id);
+
+// host only: runs the handler of an enabled interrupt, used by the device stand-ins
+void xmk_raise_interrupt(int id);
+
+#endif
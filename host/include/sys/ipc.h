@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for xilkernel's sys/ipc.h
+ */
+#ifndef SYS_IPC_H
+#define SYS_IPC_H
+
+typedef int key_t;
+
+#define IPC_CREAT 0001000
+#define IPC_EXCL 0002000
+#define IPC_NOWAIT 0004000
+#define IPC_RMID 0
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ * Host stand-in for xilkernel's message queues. Unlike System V queues
+ * there is no message type word, msgsnd copies msgsz bytes as they are.
+ */
+#ifndef SYS_MSG_H
+#define SYS_MSG_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+
+struct msqid_ds {
+	int msg_qnum;
+	int msg_qbytes;
+};
+
+int msgget(key_t key, int msgflg);
+int msgctl(int msqid, int cmd, struct msqid_ds *buf);
+int msgsnd(int msqid, const void *msgp, size_t msgsz, int msgflg);
+ssize_t msgrcv(int msqid, void *msgp, size_t msgsz, long msgtyp, int msgflg);
+
+#endif
@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for xilkernel's sys/process.h
+ */
+#ifndef SYS_PROCESS_H
+#define SYS_PROCESS_H
+
+void yield();
+
+#endif
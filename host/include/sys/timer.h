@@ -0,0 +1,16 @@
+/*
+ * Host stand-in for xilkernel's sys/timer.h. One tick is 10ms like the
+ * board's kernel configuration, sleep() takes milliseconds.
+ */
+#ifndef SYS_TIMER_H
+#define SYS_TIMER_H
+
+#define SYSTMR_INTERVAL_MS 10
+
+unsigned int xget_clock_ticks();
+unsigned int xmk_sleep(unsigned int ms);
+
+// xilkernel's sleep() counts milliseconds, not seconds
+#define sleep(ms) xmk_sleep(ms)
+
+#endif
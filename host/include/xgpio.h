@@ -0,0 +1,38 @@
+/*
+ * Host stand-in for the XGpio driver. Channel 1 replays a push button
+ * script from the BB_BUTTONS environment variable, a comma separated list
+ * of tick=buttons entries, for example "150=R,180=0,400=C,460=C". Buttons
+ * are L R C T B for left, right, centre, top, bottom, or a number, and 0
+ * releases. Every change raises the gpio interrupt.
+ */
+#ifndef XGPIO_H
+#define XGPIO_H
+
+#include "xil_types.h"
+#include "xstatus.h"
+
+typedef struct {
+	u16 DeviceId;
+	UINTPTR BaseAddress;
+	int InterruptPresent;
+	int IsDual;
+} XGpio_Config;
+
+typedef struct {
+	UINTPTR BaseAddress;
+	u32 IsReady;
+	int InterruptPresent;
+	int IsDual;
+} XGpio;
+
+int XGpio_Initialize(XGpio *InstancePtr, u16 DeviceId);
+void XGpio_SetDataDirection(XGpio *InstancePtr, unsigned Channel, u32 DirectionMask);
+u32 XGpio_DiscreteRead(XGpio *InstancePtr, unsigned Channel);
+void XGpio_InterruptGlobalEnable(XGpio *InstancePtr);
+void XGpio_InterruptGlobalDisable(XGpio *InstancePtr);
+void XGpio_InterruptEnable(XGpio *InstancePtr, u32 Mask);
+void XGpio_InterruptDisable(XGpio *InstancePtr, u32 Mask);
+void XGpio_InterruptClear(XGpio *InstancePtr, u32 Mask);
+u32 XGpio_InterruptGetStatus(XGpio *InstancePtr);
+
+#endif
@@ -0,0 +1,11 @@
+/*
+ * Host stand-in for xil_cache.h, the host has coherent caches.
+ */
+#ifndef XIL_CACHE_H
+#define XIL_CACHE_H
+
+#define Xil_DCacheFlushRange(adr, len)
+#define Xil_DCacheInvalidateRange(adr, len)
+#define Xil_DCacheFlush()
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * Host stand-in for the Xilinx standalone types, see ../README section on
+ * the host simulation.
+ */
+#ifndef XIL_TYPES_H
+#define XIL_TYPES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef uintptr_t UINTPTR;
+
+#ifndef NULL
+#define NULL ((void *) 0)
+#endif
+
+#define XIL_COMPONENT_IS_READY 0x11111111U
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * Host stand-in for the XMbox driver. The two processors are two processes,
+ * each direction of the mailbox is a single producer single consumer ring
+ * in POSIX shared memory.
+ */
+#ifndef XMBOX_H
+#define XMBOX_H
+
+#include "xil_types.h"
+#include "xstatus.h"
+
+typedef struct {
+	u16 DeviceId;
+	UINTPTR BaseAddress;
+	u32 UseFSL;
+	u32 SendID;
+	u32 RecvID;
+} XMbox_Config;
+
+typedef struct {
+	XMbox_Config Config;
+	u32 IsReady;
+} XMbox;
+
+XMbox_Config *XMbox_LookupConfig(u16 DeviceId);
+int XMbox_CfgInitialize(XMbox *InstancePtr, XMbox_Config *ConfigPtr, UINTPTR EffectiveAddress);
+int XMbox_Read(XMbox *InstancePtr, u32 *BufferPtr, u32 RequestedBytes, u32 *BytesRecvdPtr);
+void XMbox_ReadBlocking(XMbox *InstancePtr, u32 *BufferPtr, u32 RequestedBytes);
+int XMbox_Write(XMbox *InstancePtr, u32 *BufferPtr, u32 RequestedBytes, u32 *BytesSentPtr);
+void XMbox_WriteBlocking(XMbox *InstancePtr, u32 *BufferPtr, u32 RequestedBytes);
+u32 XMbox_IsEmpty(XMbox *InstancePtr);
+u32 XMbox_IsFull(XMbox *InstancePtr);
+
+#endif
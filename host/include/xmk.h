@@ -0,0 +1,17 @@
+/*
+ * Host stand-in for xilkernel's xmk.h. Pulls in the pieces every xilkernel
+ * application gets for free: the Xilinx types and xil_printf.
+ */
+#ifndef XMK_H
+#define XMK_H
+
+#include "xil_types.h"
+
+void xil_printf(const char *format, ...);
+void print(const char *string);
+
+// host only: hooks run by xilkernel_main before the simulation exits
+void xmk_add_report(void (*report)(double seconds));
+double xmk_seconds();
+
+#endif
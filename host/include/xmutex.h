@@ -0,0 +1,35 @@
+/*
+ * Host stand-in for the XMutex driver, backed by the same shared memory as
+ * the mailbox. Like the hardware, a lock is owned by a processor, not by a
+ * thread.
+ */
+#ifndef XMUTEX_H
+#define XMUTEX_H
+
+#include "xil_types.h"
+#include "xstatus.h"
+
+#define XMUTEX_NUM_LOCKS 8
+
+typedef struct {
+	u16 DeviceId;
+	UINTPTR BaseAddress;
+	u32 NumMutex;
+	u32 UserReg;
+} XMutex_Config;
+
+typedef struct {
+	XMutex_Config Config;
+	u32 IsReady;
+} XMutex;
+
+XMutex_Config *XMutex_LookupConfig(u16 DeviceId);
+int XMutex_CfgInitialize(XMutex *InstancePtr, XMutex_Config *ConfigPtr, UINTPTR EffectiveAddress);
+void XMutex_Lock(XMutex *InstancePtr, u8 MutexNumber);
+int XMutex_Trylock(XMutex *InstancePtr, u8 MutexNumber);
+int XMutex_Unlock(XMutex *InstancePtr, u8 MutexNumber);
+int XMutex_IsLocked(XMutex *InstancePtr, u8 MutexNumber);
+int XMutex_GetUser(XMutex *InstancePtr, u8 MutexNumber, u32 *User);
+int XMutex_SetUser(XMutex *InstancePtr, u8 MutexNumber, u32 User);
+
+#endif
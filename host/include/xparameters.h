@@ -0,0 +1,31 @@
+/*
+ * Host stand-in for the BSP generated xparameters.h. One header serves both
+ * processors, the build picks the side with -DXPAR_CPU_ID=0 (game) or 1 (ball).
+ */
+#ifndef XPARAMETERS_H
+#define XPARAMETERS_H
+
+#ifndef XPAR_CPU_ID
+#define XPAR_CPU_ID 0
+#endif
+
+#define XPAR_PS7_DDR_0_S_AXI_BASEADDR 0x00100000
+#define XPAR_PS7_DDR_0_S_AXI_HIGHADDR 0x3FFFFFFF
+
+#define XPAR_TFT_0_DEVICE_ID 0
+#define XPAR_TFT_0_BASEADDR 0x44A00000
+
+#define XPAR_GPIO_0_DEVICE_ID 0
+#define XPAR_MICROBLAZE_0_AXI_INTC_AXI_GPIO_0_IP2INTC_IRPT_INTR 0
+
+#define XPAR_MUTEX_0_IF_0_DEVICE_ID 0
+#define XPAR_MBOX_0_DEVICE_ID 0
+
+#define XPAR_TMRCTR_0_DEVICE_ID 0
+#define XPAR_TMRCTR_0_BASEADDR 0x41C00000
+#define XPAR_TMRCTR_0_CLOCK_FREQ_HZ 100000000
+
+#define STDIN_BASEADDRESS 0xE0001000
+#define STDOUT_BASEADDRESS 0xE0001000
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * Host stand-in for xstatus.h
+ */
+#ifndef XSTATUS_H
+#define XSTATUS_H
+
+#include "xil_types.h"
+
+typedef s32 XStatus;
+
+#ifndef XST_SUCCESS
+#define XST_SUCCESS 0L
+#endif
+#ifndef XST_FAILURE
+#define XST_FAILURE 1L
+#endif
+#define XST_DEVICE_NOT_FOUND 2L
+#define XST_NO_DATA 13L
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Host stand-in for the XTft driver. Video memory lives in the DDR window
+ * the host maps at the board's physical addresses, with the hardware's
+ * 1024 pixel line pitch, so code that writes the frame directly works the
+ * same on both.
+ */
+#ifndef XTFT_H
+#define XTFT_H
+
+#include "xil_types.h"
+#include "xil_io.h"
+#include "xstatus.h"
+
+#define XTFT_DISPLAY_WIDTH 640
+#define XTFT_DISPLAY_HEIGHT 480
+#define XTFT_DISPLAY_BUFFER_WIDTH 1024
+#define XTFT_CHAR_WIDTH 8
+#define XTFT_CHAR_HEIGHT 12
+
+#define XTFT_AR_OFFSET 0
+#define XTFT_CR_OFFSET 4
+#define XTFT_IESR_OFFSET 8
+
+#define XTFT_CR_TDE_MASK 0x00000001
+#define XTFT_CR_DPS_MASK 0x00000002
+#define XTFT_IESR_VADDRLATCH_STATUS_MASK 0x00000001
+#define XTFT_IESR_IE_MASK 0x00000008
+
+typedef struct {
+	u16 DeviceId;
+	UINTPTR BaseAddress;
+	UINTPTR VideoMemBaseAddr;
+	u32 PlbAccess;
+	u32 DcrReg;
+	u32 AddrWidth;
+} XTft_Config;
+
+typedef struct {
+	XTft_Config TftConfig;
+	u32 IsReady;
+	u32 ColVal;
+	u32 RowVal;
+	u32 FgColor;
+	u32 BgColor;
+} XTft;
+
+XTft_Config *XTft_LookupConfig(u16 DeviceId);
+int XTft_CfgInitialize(XTft *InstancePtr, XTft_Config *ConfigPtr, UINTPTR EffectiveAddr);
+void XTft_SetPos(XTft *InstancePtr, u32 ColVal, u32 RowVal);
+void XTft_SetPosChar(XTft *InstancePtr, u32 ColVal, u32 RowVal);
+void XTft_SetColor(XTft *InstancePtr, u32 FgColor, u32 BgColor);
+void XTft_SetPixel(XTft *InstancePtr, u32 ColVal, u32 RowVal, u32 PixelVal);
+void XTft_GetPixel(XTft *InstancePtr, u32 ColVal, u32 RowVal, u32 *PixelVal);
+void XTft_Write(XTft *InstancePtr, u8 CharValue);
+void XTft_ClearScreen(XTft *InstancePtr);
+void XTft_FillScreen(XTft *InstancePtr, u32 ColStartVal, u32 RowStartVal, u32 ColEndVal, u32 RowEndVal, u32 PixelVal);
+void XTft_SetFrameBaseAddr(XTft *InstancePtr, UINTPTR NewFrameBaseAddr);
+u32 XTft_GetVsyncStatus(XTft *InstancePtr);
+void XTft_EnableDisplay(XTft *InstancePtr);
+void XTft_DisableDisplay(XTft *InstancePtr);
+
+// register access goes through the host model of the controller
+void XTft_WriteReg(UINTPTR BaseAddress, u32 RegOffset, u32 Data);
+u32 XTft_ReadReg(UINTPTR BaseAddress, u32 RegOffset);
+
+// host only: the frame the controller is scanning out
+UINTPTR XTft_HostDisplayedFrame();
+// host only: writes a frame as a binary PPM, 0 on success
+int XTft_HostDumpPPM(UINTPTR frame, const char *path);
+
+#endif
@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for the XTft driver's character table, used by XTft_Write.
+ */
+#ifndef XTFT_CHARCODE_H
+#define XTFT_CHARCODE_H
+
+#include "xil_types.h"
+#include "xtft.h"
+
+#define XTFT_ASCIICHAR_OFFSET 32	// first character in the table, a space
+#define XTFT_ASCIICHAR_COUNT 95		// up to '~', anything else is drawn as a space
+
+extern const u8 XTft_VidChars[XTFT_ASCIICHAR_COUNT][XTFT_CHAR_HEIGHT];
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * Host stand-in for the XTmrCtr driver. Counter 0 free runs at
+ * XPAR_TMRCTR_0_CLOCK_FREQ_HZ off the host monotonic clock, so every process
+ * reads the same count like two processors sharing one AXI timer.
+ */
+#ifndef XTMRCTR_H
+#define XTMRCTR_H
+
+#include "xil_types.h"
+#include "xstatus.h"
+
+#define XTC_AUTO_RELOAD_OPTION 0x00000010UL
+#define XTC_DOWN_COUNT_OPTION 0x00000020UL
+
+typedef struct {
+	u16 DeviceId;
+	UINTPTR BaseAddress;
+	u32 SysClockFreqHz;
+} XTmrCtr_Config;
+
+typedef struct {
+	XTmrCtr_Config Config;
+	u32 IsReady;
+	u32 IsStartedTmrCtr0;
+	u32 IsStartedTmrCtr1;
+} XTmrCtr;
+
+XTmrCtr_Config *XTmrCtr_LookupConfig(u16 DeviceId);
+int XTmrCtr_Initialize(XTmrCtr *InstancePtr, u16 DeviceId);
+void XTmrCtr_CfgInitialize(XTmrCtr *InstancePtr, XTmrCtr_Config *ConfigPtr, UINTPTR EffectiveAddr);
+void XTmrCtr_SetOptions(XTmrCtr *InstancePtr, u8 TmrCtrNumber, u32 Options);
+void XTmrCtr_Start(XTmrCtr *InstancePtr, u8 TmrCtrNumber);
+void XTmrCtr_Stop(XTmrCtr *InstancePtr, u8 TmrCtrNumber);
+u32 XTmrCtr_GetValue(XTmrCtr *InstancePtr, u8 TmrCtrNumber);
+
+#endif
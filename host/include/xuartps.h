@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for the polled receive side of the XUartPs driver. Bytes
+ * come from stdin, or from the BB_UART environment variable, a comma
+ * separated list of tick=character entries such as "500=s".
+ */
+#ifndef XUARTPS_H
+#define XUARTPS_H
+
+#include "xil_types.h"
+
+u32 XUartPs_IsReceiveData(UINTPTR BaseAddress);
+u8 XUartPs_RecvByte(UINTPTR BaseAddress);
+
+#endif
@@ -0,0 +1,516 @@
+/*
+ * Drawing benchmark for the game processor.
+ *
+ *	renderbench [mpixels]
+ *
+ * Links against game_receiver.c built with -Dmain=receiver_main and times
+ * XTft_DrawSolidBox and XTft_DrawSolidCircle, recorded and composed one at
+ * a time, against the XTft_SetPixel loops they replaced, which are kept
+ * here as the reference. The frame case draws what a typical frame draws,
+ * the ball and bar moving and a HUD box, and composes it at once. The
+ * ball+bar case moves both through drawBall and drawBar, which blit the
+ * sprites, against the boxes and circle they used to be drawn from. Every
+ * case draws about mpixels million pixels (default 200) each way and
+ * checks that both leave the same frame behind.
+ *
+ * The speed cases move the ball diagonally by 1 to 20 pixels per frame and
+ * count the pixels written, erasing the bounding box and drawing the whole
+ * ball against erasing and drawing only the crescents that changed. The
+ * stripes cases fill a crystal brick and a larger box with the stripe
+ * pattern against the per pixel modulo test XTft_DrawStripes used. The
+ * brick edge case runs the ball through a brick and checks the brick is
+ * whole once it has left.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "xparameters.h"
+#include "xtft.h"
+#include "../frame_stats.h"
+
+#define TFT_FRAME_ADDR 0x10000000
+#define FRAME_BYTES (XTFT_DISPLAY_BUFFER_WIDTH * XTFT_DISPLAY_HEIGHT * 4)
+#define GAMEAREA_LEFT 60
+#define GAMEAREA_TOP 60
+#define GAMEAREA_RIGHT 514
+#define GAMEAREA_BTM 419
+#define CIRCLE_RADIUS 7
+#define BALL_COLOUR 0x00ffa500
+#define GAMEAREA_COLOUR 0x0000ff00
+#define BAR_COLOUR 0x000000ff
+#define BAR_S_COLOUR 0x0020b2aa
+#define BAR_A_COLOUR 0x00ffd700
+#define BAR_TOP 405
+#define BAR_BTM 409
+#define HALFBARLENG 40
+#define BRICK_COLOUR 0x00ffff00
+#define BRICK_COLOUR_STRIPES 0x00000000
+
+// from game_receiver.c
+typedef struct tft_pattern tft_pattern;
+extern tft_pattern stripe_pattern;
+int XTft_DrawPattern(XTft *Tft, int x1, int y1, int x2, int y2, tft_pattern *pattern);
+extern pthread_mutex_t tft_mutex;
+int XTft_DrawSolidBox(XTft *Tft, int x1, int y1, int x2, int y2, unsigned int col);
+void XTft_DrawSolidCircle(XTft *Tft, int x, int y);
+void tft_begin();
+void tft_end();
+void tft_compose(XTft *Tft);
+void sprite_init();
+void tft_bgbox(int x1, int y1, int x2, int y2, unsigned int col);
+void tft_restore(XTft *Tft, int x1, int y1, int x2, int y2);
+void drawBall(XTft *Tft, int x, int y, int* ball_ptr_x, int* ball_ptr_y);
+void drawBar(XTft *Tft, int cursor, int* cursor_drawn_ptr, int poweruplengthen_last, int lengthen);
+
+typedef struct {
+	const char *name;
+	int x1, y1, x2, y2;
+} box_case;
+
+static box_case boxes[] = {
+	{ "game area", GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM },
+	{ "text box", 555, 60, 599, 79 },
+	{ "brick", 65, 65, 105, 80 },
+	{ "ball erase", 281, 391, 295, 405 },
+	{ "bar segment", 248, 405, 257, 409 },
+};
+
+static box_case stripe_boxes[] = {
+	{ "stripes", 110, 105, 150, 120 },		// crystal brick
+	{ "stripes", 100, 100, 399, 299 },
+};
+
+// ball moving 5 pixels, bar moving 8 and one HUD box, as thread_game and thread_bar draw them
+static box_case frame_boxes[] = {
+	{ "ball erase", 281, 391, 295, 405 },
+	{ "bar erase", 248, 405, 327, 409 },
+	{ "bar", 256, 405, 265, 409 },
+	{ "bar", 266, 405, 275, 409 },
+	{ "bar", 276, 405, 315, 409 },
+	{ "bar", 316, 405, 325, 409 },
+	{ "bar", 326, 405, 335, 409 },
+	{ "time box", 535, 240, 629, 269 },
+};
+
+static XTft Tft;
+static u32 *reference;
+
+static void setpixel_disc(int x, int y, u32 col);
+
+static double now_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// XTft_DrawSolidBox before the span fill, one column at a time
+static void setpixel_box(int x1, int y1, int x2, int y2, u32 col)
+{
+	int i, j;
+
+	pthread_mutex_lock(&tft_mutex);
+	for (i = x1; i <= x2; i++)
+		for (j = y1; j <= y2; j++)
+			XTft_SetPixel(&Tft, i, j, col);
+	pthread_mutex_unlock(&tft_mutex);
+}
+
+// XTft_DrawSolidCircle before the span fill
+static void setpixel_circle(int x, int y)
+{
+	setpixel_disc(x, y, BALL_COLOUR);
+}
+
+static void setpixel_disc(int x, int y, u32 col)
+{
+	int radius = CIRCLE_RADIUS;
+	int i, j, height, pixel_x, pixel_y;
+
+	pthread_mutex_lock(&tft_mutex);
+	for (i = -radius; i <= radius; i++)
+	{
+		height = (int) sqrt(radius * radius - i * i);
+		pixel_x = i + x;
+		for (j = -height; j <= height; j++)
+		{
+			pixel_y = j + y;
+			if (pixel_x >= GAMEAREA_LEFT && pixel_x <= GAMEAREA_RIGHT && pixel_y >= GAMEAREA_TOP && pixel_y <= GAMEAREA_BTM)
+				XTft_SetPixel(&Tft, pixel_x, pixel_y, col);
+		}
+	}
+	pthread_mutex_unlock(&tft_mutex);
+}
+
+// XTft_DrawStripes before the pattern fill
+static void setpixel_stripes(int x1, int y1, int x2, int y2)
+{
+	int i, j;
+
+	pthread_mutex_lock(&tft_mutex);
+	for (i = x1; i <= x2; i++)
+		for (j = y1; j <= y2; j++)
+			if ((i + 2 * j + 1) % 3 == 0)
+				XTft_SetPixel(&Tft, i, j, BRICK_COLOUR_STRIPES);
+	pthread_mutex_unlock(&tft_mutex);
+}
+
+static void compose_stripes(int x1, int y1, int x2, int y2)
+{
+	tft_begin();
+	XTft_DrawPattern(&Tft, x1, y1, x2, y2, &stripe_pattern);
+	tft_compose(&Tft);
+	tft_end();
+}
+
+static void compose_box(int x1, int y1, int x2, int y2, u32 col)
+{
+	tft_begin();
+	XTft_DrawSolidBox(&Tft, x1, y1, x2, y2, col);
+	tft_compose(&Tft);
+	tft_end();
+}
+
+static void compose_circle(int x, int y)
+{
+	tft_begin();
+	XTft_DrawSolidCircle(&Tft, x, y);
+	tft_compose(&Tft);
+	tft_end();
+}
+
+static void setpixel_frame(int shift)
+{
+	int i;
+
+	for (i = 0; i < (int) (sizeof(frame_boxes) / sizeof(frame_boxes[0])); i++)
+		setpixel_box(frame_boxes[i].x1 + shift, frame_boxes[i].y1, frame_boxes[i].x2 + shift, frame_boxes[i].y2, (u32) (i + shift));
+	setpixel_circle(283 + shift, 393);
+}
+
+static void compose_frame(int shift)
+{
+	int i;
+
+	tft_begin();
+	for (i = 0; i < (int) (sizeof(frame_boxes) / sizeof(frame_boxes[0])); i++)
+		XTft_DrawSolidBox(&Tft, frame_boxes[i].x1 + shift, frame_boxes[i].y1, frame_boxes[i].x2 + shift, frame_boxes[i].y2, (u32) (i + shift));
+	XTft_DrawSolidCircle(&Tft, 283 + shift, 393);
+	tft_compose(&Tft);
+	tft_end();
+}
+
+static int ball_x, ball_y, bar_drawn;
+
+static void ballbar_position(long n, int *x, int *y, int *cursor)
+{
+	*x = 100 + (int) (n & 63) * 5;
+	*y = 300 + (int) (n & 15);
+	*cursor = 110 + (int) (n & 63) * 4;
+}
+
+// drawBall and drawBar before the sprites, the ball erased where it was
+static void setpixel_ballbar(long n)
+{
+	int x, y, cursor;
+
+	ballbar_position(n, &x, &y, &cursor);
+	setpixel_disc(ball_x, ball_y, GAMEAREA_COLOUR);
+	setpixel_circle(x, y);
+	ball_x = x;
+	ball_y = y;
+
+	setpixel_box(bar_drawn - HALFBARLENG, BAR_TOP, bar_drawn + HALFBARLENG - 1, BAR_BTM, GAMEAREA_COLOUR);
+	setpixel_box(cursor - HALFBARLENG, BAR_TOP, cursor - HALFBARLENG + 9, BAR_BTM, BAR_A_COLOUR);
+	setpixel_box(cursor - HALFBARLENG + 10, BAR_TOP, cursor - HALFBARLENG + 19, BAR_BTM, BAR_S_COLOUR);
+	setpixel_box(cursor - 20, BAR_TOP, cursor + 19, BAR_BTM, BAR_COLOUR);
+	setpixel_box(cursor + HALFBARLENG - 20, BAR_TOP, cursor + HALFBARLENG - 11, BAR_BTM, BAR_S_COLOUR);
+	setpixel_box(cursor + HALFBARLENG - 10, BAR_TOP, cursor + HALFBARLENG - 1, BAR_BTM, BAR_A_COLOUR);
+	bar_drawn = cursor;
+}
+
+static void compose_ballbar(long n)
+{
+	int x, y, cursor;
+
+	ballbar_position(n, &x, &y, &cursor);
+	tft_begin();
+	drawBall(&Tft, x, y, &ball_x, &ball_y);
+	drawBar(&Tft, cursor, &bar_drawn, 0, 0);
+	tft_compose(&Tft);
+	tft_end();
+}
+
+// bounces diagonally in the game area, speed pixels along each axis per frame
+static void speed_position(long n, int speed, int *x, int *y)
+{
+	int w = GAMEAREA_RIGHT - GAMEAREA_LEFT - 2 * CIRCLE_RADIUS;
+	int h = GAMEAREA_BTM - GAMEAREA_TOP - 2 * CIRCLE_RADIUS;
+	long tx = (n * speed) % (2 * w);
+	long ty = (n * speed) % (2 * h);
+
+	*x = GAMEAREA_LEFT + CIRCLE_RADIUS + (int) (tx < w ? tx : 2 * w - tx);
+	*y = GAMEAREA_TOP + CIRCLE_RADIUS + (int) (ty < h ? ty : 2 * h - ty);
+}
+
+// pixels the erase box at ox, oy and the ball at x, y cover together
+static int boxcircle_pixels(int ox, int oy, int x, int y)
+{
+	int i, j, count = 0;
+	int x1 = ox < x ? ox : x, x2 = ox > x ? ox : x;
+	int y1 = oy < y ? oy : y, y2 = oy > y ? oy : y;
+
+	for (j = y1 - CIRCLE_RADIUS; j <= y2 + CIRCLE_RADIUS; j++)
+		for (i = x1 - CIRCLE_RADIUS; i <= x2 + CIRCLE_RADIUS; i++)
+			count += (abs(i - ox) <= CIRCLE_RADIUS && abs(j - oy) <= CIRCLE_RADIUS)
+				|| (i - x) * (i - x) + (j - y) * (j - y) <= CIRCLE_RADIUS * CIRCLE_RADIUS;
+	return count;
+}
+
+static void clear_frame()
+{
+	memset((void *) TFT_FRAME_ADDR, 0, FRAME_BYTES);
+}
+
+static int same_frame()
+{
+	return memcmp(reference, (void *) TFT_FRAME_ADDR, FRAME_BYTES) == 0;
+}
+
+static void report(const char *name, long calls, long pixels, double old_s, double new_s, int same)
+{
+	double old_rate = calls * pixels / old_s / 1e6;
+	double new_rate = calls * pixels / new_s / 1e6;
+
+	printf("%-12s %7ld px %9ld calls  setpixel %8.1f Mpx/s  composed %8.1f Mpx/s  x%5.1f  %s\n",
+		name, pixels, calls, old_rate, new_rate, new_rate / old_rate, same ? "same" : "DIFFERENT");
+}
+
+int main(int argc, char **argv)
+{
+	double budget = (argc > 1 ? atof(argv[1]) : 200) * 1e6;
+	int failed = 0;
+	static const int speeds[] = {1, 2, 5, 10, 15, 20};
+	long calls, pixels, n, boxcircle;
+	double start, old_s, new_s;
+	unsigned int written;
+	int i, j, x, y, same;
+
+	XTft_CfgInitialize(&Tft, XTft_LookupConfig(XPAR_TFT_0_DEVICE_ID), XPAR_TFT_0_BASEADDR);
+	XTft_SetFrameBaseAddr(&Tft, TFT_FRAME_ADDR);
+	pthread_mutex_init(&tft_mutex, NULL);
+	sprite_init();
+	tft_bgbox(GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM, GAMEAREA_COLOUR);	// what the ball and bar are erased to
+	reference = malloc(FRAME_BYTES);
+
+	for (i = 0; i < (int) (sizeof(boxes) / sizeof(boxes[0])); i++)
+	{
+		box_case *b = &boxes[i];
+
+		pixels = (long) (b->x2 - b->x1 + 1) * (b->y2 - b->y1 + 1);
+		calls = (long) (budget / pixels) + 1;
+
+		clear_frame();
+		start = now_seconds();
+		for (n = 0; n < calls; n++)
+			setpixel_box(b->x1, b->y1, b->x2, b->y2, (u32) n);
+		old_s = now_seconds() - start;
+		memcpy(reference, (void *) TFT_FRAME_ADDR, FRAME_BYTES);
+
+		clear_frame();
+		start = now_seconds();
+		for (n = 0; n < calls; n++)
+			compose_box(b->x1, b->y1, b->x2, b->y2, (u32) n);
+		new_s = now_seconds() - start;
+
+		same = same_frame();
+		failed |= !same;
+		report(b->name, calls, pixels, old_s, new_s, same);
+	}
+
+	// over a brick coloured box drawn first each way
+	for (i = 0; i < (int) (sizeof(stripe_boxes) / sizeof(stripe_boxes[0])); i++)
+	{
+		box_case *b = &stripe_boxes[i];
+
+		pixels = (long) (b->x2 - b->x1 + 1) * (b->y2 - b->y1 + 1);
+		calls = (long) (budget / pixels) + 1;
+
+		clear_frame();
+		setpixel_box(b->x1, b->y1, b->x2, b->y2, BRICK_COLOUR);
+		start = now_seconds();
+		for (n = 0; n < calls; n++)
+			setpixel_stripes(b->x1, b->y1, b->x2, b->y2);
+		old_s = now_seconds() - start;
+		memcpy(reference, (void *) TFT_FRAME_ADDR, FRAME_BYTES);
+
+		clear_frame();
+		compose_box(b->x1, b->y1, b->x2, b->y2, BRICK_COLOUR);
+		start = now_seconds();
+		for (n = 0; n < calls; n++)
+			compose_stripes(b->x1, b->y1, b->x2, b->y2);
+		new_s = now_seconds() - start;
+
+		same = same_frame();
+		failed |= !same;
+		report(b->name, calls, pixels, old_s, new_s, same);
+	}
+
+	// whole ball and one clipped by the top left corner of the game area
+	pixels = 0;
+	for (i = -CIRCLE_RADIUS; i <= CIRCLE_RADIUS; i++)
+		for (j = -CIRCLE_RADIUS; j <= CIRCLE_RADIUS; j++)
+			pixels += i * i + j * j <= CIRCLE_RADIUS * CIRCLE_RADIUS;
+	calls = (long) (budget / pixels) + 1;
+
+	clear_frame();
+	start = now_seconds();
+	for (n = 0; n < calls; n++)
+		setpixel_circle(288 + (n & 63), 300);
+	setpixel_circle(GAMEAREA_LEFT + 2, GAMEAREA_TOP + 3);
+	old_s = now_seconds() - start;
+	memcpy(reference, (void *) TFT_FRAME_ADDR, FRAME_BYTES);
+
+	clear_frame();
+	start = now_seconds();
+	for (n = 0; n < calls; n++)
+		compose_circle(288 + (n & 63), 300);
+	compose_circle(GAMEAREA_LEFT + 2, GAMEAREA_TOP + 3);
+	new_s = now_seconds() - start;
+
+	same = same_frame();
+	failed |= !same;
+	report("ball", calls, pixels, old_s, new_s, same);
+
+	// pixels per frame as the primitives cover them, shifted right by up to 7 between frames
+	pixels = 0;
+	for (i = 0; i < (int) (sizeof(frame_boxes) / sizeof(frame_boxes[0])); i++)
+		pixels += (long) (frame_boxes[i].x2 - frame_boxes[i].x1 + 1) * (frame_boxes[i].y2 - frame_boxes[i].y1 + 1);
+	pixels += 149;
+	calls = (long) (budget / pixels) + 1;
+
+	clear_frame();
+	start = now_seconds();
+	for (n = 0; n < calls; n++)
+		setpixel_frame(n & 7);
+	old_s = now_seconds() - start;
+	memcpy(reference, (void *) TFT_FRAME_ADDR, FRAME_BYTES);
+
+	clear_frame();
+	start = now_seconds();
+	for (n = 0; n < calls; n++)
+		compose_frame(n & 7);
+	new_s = now_seconds() - start;
+
+	same = same_frame();
+	failed |= !same;
+	report("frame", calls, pixels, old_s, new_s, same);
+
+	// erase and draw of ball and bar, as the primitives cover them
+	pixels = 15 * 15 + 149 + 2 * 2 * HALFBARLENG * (BAR_BTM - BAR_TOP + 1);
+	calls = (long) (budget / pixels) + 1;
+
+	clear_frame();
+	ball_x = 100, ball_y = 300, bar_drawn = 110;
+	start = now_seconds();
+	for (n = 0; n < calls; n++)
+		setpixel_ballbar(n);
+	old_s = now_seconds() - start;
+	memcpy(reference, (void *) TFT_FRAME_ADDR, FRAME_BYTES);
+
+	clear_frame();
+	ball_x = 100, ball_y = 300, bar_drawn = 110;
+	start = now_seconds();
+	for (n = 0; n < calls; n++)
+		compose_ballbar(n);
+	new_s = now_seconds() - start;
+
+	same = same_frame();
+	failed |= !same;
+	report("ball+bar", calls, pixels, old_s, new_s, same);
+	printf("%-12s %.3f us per frame with setpixel, %.3f us composed\n", "ball+bar", old_s / calls * 1e6, new_s / calls * 1e6);
+
+	// pixels written per frame by the ball alone
+	for (i = 0; i < (int) (sizeof(speeds) / sizeof(speeds[0])); i++)
+	{
+		calls = (long) (budget / 2 / 149) + 1;
+
+		clear_frame();
+		speed_position(0, speeds[i], &ball_x, &ball_y);
+		boxcircle = 0;
+		start = now_seconds();
+		for (n = 1; n <= calls; n++)
+		{
+			speed_position(n, speeds[i], &x, &y);
+			setpixel_disc(ball_x, ball_y, GAMEAREA_COLOUR);
+			setpixel_circle(x, y);
+			ball_x = x;
+			ball_y = y;
+		}
+		old_s = now_seconds() - start;
+		memcpy(reference, (void *) TFT_FRAME_ADDR, FRAME_BYTES);
+		for (n = 1; n <= 1000; n++)
+		{
+			speed_position(n - 1, speeds[i], &ball_x, &ball_y);
+			speed_position(n, speeds[i], &x, &y);
+			boxcircle += boxcircle_pixels(ball_x, ball_y, x, y);
+		}
+
+		clear_frame();
+		speed_position(0, speeds[i], &ball_x, &ball_y);
+		written = framestats.written;
+		start = now_seconds();
+		for (n = 1; n <= calls; n++)
+		{
+			speed_position(n, speeds[i], &x, &y);
+			tft_begin();
+			drawBall(&Tft, x, y, &ball_x, &ball_y);
+			tft_compose(&Tft);
+			tft_end();
+		}
+		new_s = now_seconds() - start;
+		written = framestats.written - written;
+
+		same = same_frame();
+		failed |= !same;
+		printf("speed %2d px  box+circle %5.1f px  crescent %5.1f px per frame  x%4.1f  %.3f us composed  %s\n",
+			speeds[i], boxcircle / 1000.0, (double) written / calls, boxcircle / 1000.0 / ((double) written / calls),
+			new_s / calls * 1e6, same ? "same" : "DIFFERENT");
+	}
+
+	// the ball is erased to the background layer, the brick it passed is left whole
+	tft_begin();
+	tft_bgbox(200, 100, 240, 115, 0x00ff0000);
+	tft_restore(&Tft, GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM);
+	tft_compose(&Tft);
+	tft_end();
+	setpixel_circle(400, 300);
+	memcpy(reference, (void *) TFT_FRAME_ADDR, FRAME_BYTES);
+	tft_begin();
+	tft_restore(&Tft, GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM);
+	tft_compose(&Tft);
+	tft_end();
+	ball_x = 190, ball_y = 90;
+	for (n = 0; n < 30; n++)
+	{
+		tft_begin();
+		drawBall(&Tft, 190 + (int) n * 2, 90 + (int) n, &ball_x, &ball_y);
+		tft_compose(&Tft);
+		tft_end();
+	}
+	tft_begin();
+	drawBall(&Tft, 400, 300, &ball_x, &ball_y);
+	tft_compose(&Tft);
+	tft_end();
+
+	same = same_frame();
+	failed |= !same;
+	printf("%-12s ball passed through a brick  %s\n", "brick edge", same ? "same" : "DIFFERENT");
+
+	return failed;
+}
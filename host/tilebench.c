@@ -0,0 +1,176 @@
+/*
+ * Scaling benchmark of the tiled compositor.
+ *
+ *	tilebench [threads] [frames]
+ *
+ * Links against game_receiver.c built with -Dmain=receiver_main, like
+ * renderbench, and with -DTFT_TILE_THREADS set to at least threads. Each
+ * case records what a full-frame redraw records and composes it, first on
+ * thread_render's composer alone and then in tiles on 2 to threads threads
+ * (default the number of cores, at most 8), frames times each way. The
+ * time per frame and the speedup over one thread are printed for every
+ * count, with a check that the frame left behind is the same as the one
+ * composed by one thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "xparameters.h"
+#include "xtft.h"
+
+#define TFT_FRAME_ADDR 0x10000000
+#define FRAME_BYTES (XTFT_DISPLAY_BUFFER_WIDTH * XTFT_DISPLAY_HEIGHT * 4)
+#define DISPLAY_COLUMNS 640
+#define DISPLAY_ROWS 480
+#define GAMEAREA_LEFT 60
+#define GAMEAREA_TOP 60
+#define GAMEAREA_RIGHT 514
+#define GAMEAREA_BTM 419
+#define GAMEAREA_COLOUR 0x0000ff00
+#define TEXTBOX_COLOUR 0x00003366
+#define TOTAL_COLUMNS 10
+#define HUD_SCORE 1
+#define HUD_TIME 2
+#define MAX_THREADS 8
+
+// from game_receiver.c
+typedef struct tft_pattern tft_pattern;
+extern tft_pattern stripe_pattern;
+extern pthread_mutex_t tft_mutex;
+int XTft_DrawSolidBox(XTft *Tft, int x1, int y1, int x2, int y2, unsigned int col);
+int XTft_DrawPattern(XTft *Tft, int x1, int y1, int x2, int y2, tft_pattern *pattern);
+void XTft_DrawSolidCircle(XTft *Tft, int x, int y);
+void XTft_DrawTextBox(XTft *Tft, int x1, int y1, int x2, int y2, char* cstringtext);
+void drawBar(XTft *Tft, int cursor, int* cursor_drawn_ptr, int poweruplengthen_last, int lengthen);
+void drawBCol(XTft *Tft, int bcol_id, int bcol_status, int bcol_isRed);
+void hud_init(XTft *Tft);
+void hud_number(XTft *Tft, int field, int number);
+void tft_begin();
+void tft_end();
+void tft_compose(XTft *Tft);
+void tft_restore(XTft *Tft, int x1, int y1, int x2, int y2);
+void tft_bgbox(int x1, int y1, int x2, int y2, unsigned int col);
+void tft_tilethreads(int threads);
+void sprite_init();
+
+typedef struct {
+	const char *name;
+	void (*draw)(long n);		// records the n-th frame, between tft_begin and tft_end
+} tile_case;
+
+static XTft Tft;
+static u32 *reference;
+static int bar_drawn;
+
+static double now_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// the game area and bricks as init_screen draws them, red columns moving along
+static void draw_screen(long n)
+{
+	int i;
+
+	tft_restore(&Tft, GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM);
+	for (i = 1; i <= TOTAL_COLUMNS; i++)
+	{
+		drawBCol(&Tft, i, 0xff, (i + n) % 5 == 0);
+	}
+	XTft_DrawSolidCircle(&Tft, 100 + (int) (n % 300), 300);
+	drawBar(&Tft, 120 + (int) (n % 300), &bar_drawn, 0, 0);
+}
+
+// a box, the stripes and the ball over the whole game area
+static void draw_layers(long n)
+{
+	XTft_DrawSolidBox(&Tft, GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM, (u32) n);
+	XTft_DrawPattern(&Tft, GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM, &stripe_pattern);
+	XTft_DrawSolidCircle(&Tft, 100 + (int) (n % 300), 100 + (int) (n % 200));
+}
+
+// the whole screen with the HUD boxes over it, text included
+static void draw_whole(long n)
+{
+	XTft_DrawSolidBox(&Tft, 0, 0, DISPLAY_COLUMNS - 1, DISPLAY_ROWS - 1, 0);
+	tft_restore(&Tft, GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM);
+	XTft_DrawPattern(&Tft, 0, 0, DISPLAY_COLUMNS - 1, GAMEAREA_TOP - 1, &stripe_pattern);
+	XTft_DrawTextBox(&Tft, 555, 60, 599, 79, "SCORE");
+	XTft_DrawTextBox(&Tft, 555, 200, 599, 219, "TIME");
+	hud_number(&Tft, HUD_SCORE, (int) (n % 1000));
+	hud_number(&Tft, HUD_TIME, (int) (n % 100));
+}
+
+static tile_case cases[] = {
+	{ "screen", draw_screen },
+	{ "layers", draw_layers },
+	{ "whole", draw_whole },
+};
+
+static double run(tile_case *c, long frames)
+{
+	double start;
+	long n;
+
+	memset((void *) TFT_FRAME_ADDR, 0, FRAME_BYTES);
+	bar_drawn = 288;
+	start = now_seconds();
+	for (n = 0; n < frames; n++)
+	{
+		tft_begin();
+		c->draw(n);
+		tft_compose(&Tft);
+		tft_end();
+	}
+	return now_seconds() - start;
+}
+
+int main(int argc, char **argv)
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int threads = argc > 1 ? atoi(argv[1]) : (int) (cores < MAX_THREADS ? cores : MAX_THREADS);
+	long frames = argc > 2 ? atol(argv[2]) : 2000;
+	int failed = 0;
+	double serial, tiled;
+	int i, t, same;
+
+	XTft_CfgInitialize(&Tft, XTft_LookupConfig(XPAR_TFT_0_DEVICE_ID), XPAR_TFT_0_BASEADDR);
+	XTft_SetFrameBaseAddr(&Tft, TFT_FRAME_ADDR);
+	pthread_mutex_init(&tft_mutex, NULL);
+	sprite_init();
+	hud_init(&Tft);
+	tft_bgbox(GAMEAREA_LEFT, GAMEAREA_TOP, GAMEAREA_RIGHT, GAMEAREA_BTM, GAMEAREA_COLOUR);
+	reference = malloc(FRAME_BYTES);
+	if (threads < 1)
+		threads = 1;
+
+	printf("%ld cores, %ld frames per run\n", cores, frames);
+	for (i = 0; i < (int) (sizeof(cases) / sizeof(cases[0])); i++)
+	{
+		tft_tilethreads(1);
+		serial = run(&cases[i], frames);
+		memcpy(reference, (void *) TFT_FRAME_ADDR, FRAME_BYTES);
+		printf("%-8s  1 thread   %8.1f us/frame\n", cases[i].name, serial / frames * 1e6);
+
+		for (t = 2; t <= threads; t++)
+		{
+			tft_tilethreads(t);
+			tiled = run(&cases[i], frames);
+			same = memcmp(reference, (void *) TFT_FRAME_ADDR, FRAME_BYTES) == 0;
+			failed |= !same;
+			printf("%-8s %2d threads  %8.1f us/frame  x%5.2f  %s\n",
+				cases[i].name, t, tiled / frames * 1e6, serial / tiled, same ? "same" : "DIFFERENT");
+		}
+	}
+	tft_tilethreads(1);
+
+	free(reference);
+	return failed;
+}
@@ -0,0 +1,138 @@
+/*
+ * Host stand-in for the push button XGpio, see include/xgpio.h for the
+ * BB_BUTTONS script format.
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xmk.h"
+#include "xgpio.h"
+#include "xparameters.h"
+#include "sys/intr.h"
+#include "sys/timer.h"
+
+#define MAX_SCRIPT 256
+
+static struct {
+	unsigned int tick;
+	u32 value;
+} script[MAX_SCRIPT];
+static int script_length;
+static volatile u32 buttons;
+static pthread_t script_thread;
+
+static u32 parse_buttons(const char *text)
+{
+	u32 value = 0;
+
+	for (; *text != '\0' && *text != ','; text++)
+	{
+		switch (*text)
+		{
+			case 'C': value |= 1; break;
+			case 'B': value |= 2; break;
+			case 'L': value |= 4; break;
+			case 'R': value |= 8; break;
+			case 'T': value |= 16; break;
+			default:
+				if (*text >= '0' && *text <= '9')
+					return (u32) strtoul(text, NULL, 0);
+		}
+	}
+	return value;
+}
+
+static void *script_run(void *arg)
+{
+	int i;
+
+	(void) arg;
+	for (i = 0; i < script_length; i++)
+	{
+		while (xget_clock_ticks() < script[i].tick)
+			xmk_sleep(SYSTMR_INTERVAL_MS);
+		buttons = script[i].value;
+		xmk_raise_interrupt(XPAR_MICROBLAZE_0_AXI_INTC_AXI_GPIO_0_IP2INTC_IRPT_INTR);
+	}
+	return NULL;
+}
+
+int XGpio_Initialize(XGpio *InstancePtr, u16 DeviceId)
+{
+	char *env = getenv("BB_BUTTONS");
+	char *entry;
+
+	(void) DeviceId;
+	memset(InstancePtr, 0, sizeof(XGpio));
+	InstancePtr->IsReady = XIL_COMPONENT_IS_READY;
+	InstancePtr->InterruptPresent = 1;
+
+	if (env == NULL || script_length != 0)
+		return XST_SUCCESS;
+	for (entry = env; entry != NULL && *entry != '\0' && script_length < MAX_SCRIPT; )
+	{
+		char *value = strchr(entry, '=');
+
+		if (value == NULL)
+			break;
+		script[script_length].tick = (unsigned int) strtoul(entry, NULL, 10);
+		script[script_length].value = parse_buttons(value + 1);
+		script_length++;
+		entry = strchr(value, ',');
+		if (entry != NULL)
+			entry++;
+	}
+	if (script_length != 0)
+		pthread_create(&script_thread, NULL, script_run, NULL);
+	return XST_SUCCESS;
+}
+
+void XGpio_SetDataDirection(XGpio *InstancePtr, unsigned Channel, u32 DirectionMask)
+{
+	(void) InstancePtr;
+	(void) Channel;
+	(void) DirectionMask;
+}
+
+u32 XGpio_DiscreteRead(XGpio *InstancePtr, unsigned Channel)
+{
+	(void) InstancePtr;
+	(void) Channel;
+	return buttons;
+}
+
+void XGpio_InterruptGlobalEnable(XGpio *InstancePtr)
+{
+	(void) InstancePtr;
+}
+
+void XGpio_InterruptGlobalDisable(XGpio *InstancePtr)
+{
+	(void) InstancePtr;
+}
+
+void XGpio_InterruptEnable(XGpio *InstancePtr, u32 Mask)
+{
+	(void) InstancePtr;
+	(void) Mask;
+}
+
+void XGpio_InterruptDisable(XGpio *InstancePtr, u32 Mask)
+{
+	(void) InstancePtr;
+	(void) Mask;
+}
+
+void XGpio_InterruptClear(XGpio *InstancePtr, u32 Mask)
+{
+	(void) InstancePtr;
+	(void) Mask;
+}
+
+u32 XGpio_InterruptGetStatus(XGpio *InstancePtr)
+{
+	(void) InstancePtr;
+	return 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * Host stand-in for the parts of xilkernel the game uses: static threads,
+ * the 10ms tick, interrupt handlers, message queues and xil_printf. Threads
+ * are plain pthreads.
+ *
+ * BB_SIM_SECONDS ends the run after that many seconds, SIGINT ends it early.
+ * Either way the reports registered with xmk_add_report are printed first.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xmk.h"
+#include "sys/init.h"
+#include "sys/intr.h"
+#include "sys/msg.h"
+#include "sys/process.h"
+#include "sys/timer.h"
+
+#define MAX_STATIC_THREADS 4
+#define MAX_REPORTS 8
+#define MAX_INTERRUPTS 8
+#define MAX_MSGQS 16
+#define MSGQ_CAPACITY 64
+#define MSGQ_MSGSIZE 64
+
+static struct timespec start_time;
+static volatile sig_atomic_t stop_requested;
+
+static int (*static_threads[MAX_STATIC_THREADS])(void);
+static int num_static_threads;
+
+static void (*reports[MAX_REPORTS])(double seconds);
+static int num_reports;
+
+static struct {
+	void (*handler)(void *);
+	void *arg;
+	int enabled;
+	int pending;	// raised while disabled, delivered on enable like the intc does
+} interrupts[MAX_INTERRUPTS];
+static pthread_mutex_t interrupt_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+	key_t key;
+	int used;
+	int head;
+	int count;
+	size_t size[MSGQ_CAPACITY];
+	unsigned char data[MSGQ_CAPACITY][MSGQ_MSGSIZE];
+	pthread_cond_t notempty;
+	pthread_cond_t notfull;
+} msgq;
+static msgq msgqs[MAX_MSGQS];
+static pthread_mutex_t msgq_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+double xmk_seconds()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start_time.tv_sec) + (now.tv_nsec - start_time.tv_nsec) / 1e9;
+}
+
+static void on_signal(int sig)
+{
+	(void) sig;
+	stop_requested = 1;
+}
+
+void xilkernel_init()
+{
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	for (i = 0; i < MAX_MSGQS; i++)
+	{
+		pthread_cond_init(&msgqs[i].notempty, NULL);
+		pthread_cond_init(&msgqs[i].notfull, NULL);
+	}
+}
+
+void xilkernel_start()
+{
+}
+
+int xmk_add_static_thread(int (*start_func)(void), int sched_priority)
+{
+	(void) sched_priority;
+	if (num_static_threads == MAX_STATIC_THREADS)
+		return -1;
+	static_threads[num_static_threads++] = start_func;
+	return 0;
+}
+
+void xmk_add_report(void (*report)(double seconds))
+{
+	if (num_reports < MAX_REPORTS)
+		reports[num_reports++] = report;
+}
+
+static void *static_thread_start(void *arg)
+{
+	int (*start_func)(void) = (int (*)(void)) arg;
+
+	start_func();
+	return NULL;
+}
+
+void xilkernel_main()
+{
+	pthread_t tid;
+	char *env;
+	double seconds = 0;
+	int i;
+
+	env = getenv("BB_SIM_SECONDS");
+	if (env != NULL)
+		seconds = atof(env);
+
+	for (i = 0; i < num_static_threads; i++)
+	{
+		pthread_create(&tid, NULL, static_thread_start, (void *) static_threads[i]);
+		pthread_detach(tid);
+	}
+
+	while (!stop_requested && (seconds <= 0 || xmk_seconds() < seconds))
+	{
+		usleep(10000);
+	}
+
+	seconds = xmk_seconds();
+	for (i = 0; i < num_reports; i++)
+	{
+		reports[i](seconds);
+	}
+	fflush(stdout);
+	_exit(0);
+}
+
+unsigned int xget_clock_ticks()
+{
+	return (unsigned int) (xmk_seconds() * 1000 / SYSTMR_INTERVAL_MS);
+}
+
+unsigned int xmk_sleep(unsigned int ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+	return 0;
+}
+
+void yield()
+{
+	sched_yield();
+}
+
+//
+//	Interrupts
+//
+
+unsigned int register_int_handler(int id, void (*handler)(void *), void *callback)
+{
+	if (id < 0 || id >= MAX_INTERRUPTS)
+		return -1;
+	interrupts[id].handler = handler;
+	interrupts[id].arg = callback;
+	return 0;
+}
+
+void unregister_int_handler(int id)
+{
+	interrupts[id].handler = NULL;
+}
+
+// both wait for a handler that is running, on the board it cannot overlap the caller
+void enable_interrupt(int id)
+{
+	pthread_mutex_lock(&interrupt_mutex);
+	interrupts[id].enabled = 1;
+	if (interrupts[id].pending && interrupts[id].handler != NULL)
+	{
+		interrupts[id].pending = 0;
+		interrupts[id].handler(interrupts[id].arg);
+	}
+	pthread_mutex_unlock(&interrupt_mutex);
+}
+
+void disable_interrupt(int id)
+{
+	pthread_mutex_lock(&interrupt_mutex);
+	interrupts[id].enabled = 0;
+	pthread_mutex_unlock(&interrupt_mutex);
+}
+
+void acknowledge_interrupt(int id)
+{
+	(void) id;
+}
+
+void xmk_raise_interrupt(int id)
+{
+	pthread_mutex_lock(&interrupt_mutex);
+	if (interrupts[id].enabled && interrupts[id].handler != NULL)
+		interrupts[id].handler(interrupts[id].arg);
+	else
+		interrupts[id].pending = 1;
+	pthread_mutex_unlock(&interrupt_mutex);
+}
+
+//
+//	Message queues
+//
+
+int msgget(key_t key, int msgflg)
+{
+	int i, id = -1;
+
+	pthread_mutex_lock(&msgq_mutex);
+	for (i = 0; i < MAX_MSGQS; i++)
+	{
+		if (msgqs[i].used && msgqs[i].key == key)
+		{
+			id = i;
+			break;
+		}
+	}
+	if (id == -1 && (msgflg & IPC_CREAT))
+	{
+		for (i = 0; i < MAX_MSGQS; i++)
+		{
+			if (!msgqs[i].used)
+			{
+				msgqs[i].used = 1;
+				msgqs[i].key = key;
+				msgqs[i].head = 0;
+				msgqs[i].count = 0;
+				id = i;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&msgq_mutex);
+	if (id == -1)
+		errno = ENOENT;
+	return id;
+}
+
+int msgctl(int msqid, int cmd, struct msqid_ds *buf)
+{
+	if (msqid < 0 || msqid >= MAX_MSGQS || !msgqs[msqid].used)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_mutex_lock(&msgq_mutex);
+	if (cmd == IPC_RMID)
+	{
+		msgqs[msqid].used = 0;
+		pthread_cond_broadcast(&msgqs[msqid].notfull);
+		pthread_cond_broadcast(&msgqs[msqid].notempty);
+	}
+	else if (buf != NULL)
+	{
+		buf->msg_qnum = msgqs[msqid].count;
+		buf->msg_qbytes = MSGQ_CAPACITY * MSGQ_MSGSIZE;
+	}
+	pthread_mutex_unlock(&msgq_mutex);
+	return 0;
+}
+
+int msgsnd(int msqid, const void *msgp, size_t msgsz, int msgflg)
+{
+	msgq *q;
+
+	if (msqid < 0 || msqid >= MAX_MSGQS || msgsz > MSGQ_MSGSIZE)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	q = &msgqs[msqid];
+	pthread_mutex_lock(&msgq_mutex);
+	while (q->used && q->count == MSGQ_CAPACITY)
+	{
+		if (msgflg & IPC_NOWAIT)
+		{
+			pthread_mutex_unlock(&msgq_mutex);
+			errno = EAGAIN;
+			return -1;
+		}
+		pthread_cond_wait(&q->notfull, &msgq_mutex);
+	}
+	if (!q->used)
+	{
+		pthread_mutex_unlock(&msgq_mutex);
+		errno = EIDRM;
+		return -1;
+	}
+	memcpy(q->data[(q->head + q->count) % MSGQ_CAPACITY], msgp, msgsz);
+	q->size[(q->head + q->count) % MSGQ_CAPACITY] = msgsz;
+	q->count++;
+	pthread_cond_signal(&q->notempty);
+	pthread_mutex_unlock(&msgq_mutex);
+	return 0;
+}
+
+ssize_t msgrcv(int msqid, void *msgp, size_t msgsz, long msgtyp, int msgflg)
+{
+	msgq *q;
+	size_t size;
+
+	(void) msgtyp;
+	if (msqid < 0 || msqid >= MAX_MSGQS)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	q = &msgqs[msqid];
+	pthread_mutex_lock(&msgq_mutex);
+	while (q->used && q->count == 0)
+	{
+		if (msgflg & IPC_NOWAIT)
+		{
+			pthread_mutex_unlock(&msgq_mutex);
+			errno = ENOMSG;
+			return -1;
+		}
+		pthread_cond_wait(&q->notempty, &msgq_mutex);
+	}
+	if (!q->used)
+	{
+		pthread_mutex_unlock(&msgq_mutex);
+		errno = EIDRM;
+		return -1;
+	}
+	size = q->size[q->head];
+	if (size > msgsz)
+		size = msgsz;
+	memcpy(msgp, q->data[q->head], size);
+	q->head = (q->head + 1) % MSGQ_CAPACITY;
+	q->count--;
+	pthread_cond_signal(&q->notfull);
+	pthread_mutex_unlock(&msgq_mutex);
+	return size;
+}
+
+//
+//	Console
+//
+
+void xil_printf(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+}
+
+void print(const char *string)
+{
+	fputs(string, stdout);
+}
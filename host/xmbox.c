@@ -0,0 +1,340 @@
+/*
+ * Host stand-in for the XMbox and XMutex hardware. Both live in one POSIX
+ * shared memory segment (BB_SHM, default /brickbreak) so the game and ball
+ * processes see the same FIFOs and locks. Each mailbox direction is a lock
+ * free single producer single consumer ring of 32 bit words, sized like the
+ * board's FIFO (BB_MBOX_DEPTH words, default 16).
+ *
+ * The report gives mailbox round trips per second and, for the game side,
+ * frames per second and the per frame split between waiting on the mailbox
+ * and everything else.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xmk.h"
+#include "xmbox.h"
+#include "xmutex.h"
+#include "xparameters.h"
+
+#define MBOX_MAX_DEPTH 1024
+#define SPIN_LIMIT 256
+#define HOST_HIST_BUCKETS 24
+
+typedef struct {
+	u32 head;				// written by the producer only
+	u32 tail;				// written by the consumer only
+	u32 data[MBOX_MAX_DEPTH];
+} mbox_ring;
+
+typedef struct {
+	u32 depth;
+	mbox_ring ring[2];		// ring[n] carries messages sent by processor n
+	u32 mutex_owner[XMUTEX_NUM_LOCKS];	// 0 when free, else cpu id + 1
+	u32 mutex_user[XMUTEX_NUM_LOCKS];
+} shared_hw;
+
+typedef struct {
+	unsigned long long count;
+	unsigned long long sum_ns;
+	unsigned long long bucket[HOST_HIST_BUCKETS];	// bucket i counts samples in [2^i, 2^(i+1)) us
+} host_hist;
+
+static shared_hw *hw;
+static XMbox_Config mbox_config;
+static XMutex_Config mutex_config;
+
+static unsigned long long reads, writes, words_read, words_written;
+static host_hist read_wait, write_wait, frame_work;
+static unsigned long long last_read_done;
+
+static unsigned long long now_ns()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void hist_add_ns(host_hist *hist, unsigned long long ns)
+{
+	unsigned long long us = ns / 1000;
+	int i = 0;
+
+	while ((us >> (i + 1)) != 0 && i < HOST_HIST_BUCKETS - 1)
+		i++;
+	hist->bucket[i]++;
+	hist->count++;
+	hist->sum_ns += ns;
+}
+
+// upper bound of the bucket holding the p-th percentile, in us
+static unsigned long long hist_percentile(host_hist *hist, double p)
+{
+	unsigned long long seen = 0;
+	int i;
+
+	for (i = 0; i < HOST_HIST_BUCKETS; i++)
+	{
+		seen += hist->bucket[i];
+		if (seen >= hist->count * p)
+			return 1ULL << (i + 1);
+	}
+	return 1ULL << HOST_HIST_BUCKETS;
+}
+
+static void hist_report(const char *name, host_hist *hist)
+{
+	if (hist->count == 0)
+		return;
+	printf("  %-22s avg %8.1f us  p50 < %6llu us  p99 < %6llu us\n", name,
+		hist->sum_ns / 1000.0 / hist->count, hist_percentile(hist, 0.5), hist_percentile(hist, 0.99));
+}
+
+static void mbox_report(double seconds)
+{
+	unsigned long long trips = reads < writes ? reads : writes;
+
+	printf("-- host mailbox report, cpu %d, %.1f s --\n", XPAR_CPU_ID, seconds);
+	printf("  messages sent %llu (%llu words), received %llu (%llu words)\n", writes, words_written, reads, words_read);
+	printf("  round trips per second %.1f\n", trips / seconds);
+	if (XPAR_CPU_ID == 0)
+		printf("  frames per second %.1f\n", reads / seconds);
+	hist_report("mailbox read wait", &read_wait);
+	hist_report("mailbox write wait", &write_wait);
+	hist_report(XPAR_CPU_ID == 0 ? "frame work" : "physics step work", &frame_work);
+}
+
+static int shared_hw_init()
+{
+	const char *name = getenv("BB_SHM");
+	char *env = getenv("BB_MBOX_DEPTH");
+	int fd;
+
+	if (hw != NULL)
+		return XST_SUCCESS;
+	if (name == NULL)
+		name = "/brickbreak";
+
+	fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+	if (fd < 0 || ftruncate(fd, sizeof(shared_hw)) != 0)
+	{
+		perror("shm_open");
+		return XST_FAILURE;
+	}
+	hw = mmap(NULL, sizeof(shared_hw), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hw == MAP_FAILED)
+	{
+		perror("mmap");
+		hw = NULL;
+		return XST_FAILURE;
+	}
+
+	// whoever comes first sizes the fifo, a fresh segment is all zeroes
+	__atomic_compare_exchange_n(&hw->depth, &(u32){0}, env != NULL ? (u32) atoi(env) : 16, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	if (hw->depth == 0 || hw->depth > MBOX_MAX_DEPTH)
+		hw->depth = MBOX_MAX_DEPTH;
+
+	xmk_add_report(mbox_report);
+	return XST_SUCCESS;
+}
+
+static void backoff(int *spins)
+{
+	if (++*spins < SPIN_LIMIT)
+		sched_yield();
+	else
+		usleep(50);
+}
+
+//
+//	Mailbox
+//
+
+XMbox_Config *XMbox_LookupConfig(u16 DeviceId)
+{
+	mbox_config.DeviceId = DeviceId;
+	mbox_config.SendID = XPAR_CPU_ID;
+	mbox_config.RecvID = 1 - XPAR_CPU_ID;
+	return &mbox_config;
+}
+
+int XMbox_CfgInitialize(XMbox *InstancePtr, XMbox_Config *ConfigPtr, UINTPTR EffectiveAddress)
+{
+	InstancePtr->Config = *ConfigPtr;
+	InstancePtr->Config.BaseAddress = EffectiveAddress;
+	if (shared_hw_init() != XST_SUCCESS)
+		return XST_FAILURE;
+	InstancePtr->IsReady = XIL_COMPONENT_IS_READY;
+	return XST_SUCCESS;
+}
+
+static int ring_put(mbox_ring *ring, u32 word)
+{
+	u32 head = ring->head;
+
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == hw->depth)
+		return 0;
+	ring->data[head % MBOX_MAX_DEPTH] = word;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static int ring_get(mbox_ring *ring, u32 *word)
+{
+	u32 tail = ring->tail;
+
+	if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+		return 0;
+	*word = ring->data[tail % MBOX_MAX_DEPTH];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+int XMbox_Read(XMbox *InstancePtr, u32 *BufferPtr, u32 RequestedBytes, u32 *BytesRecvdPtr)
+{
+	mbox_ring *ring = &hw->ring[InstancePtr->Config.RecvID];
+	u32 n = 0;
+
+	while (n < RequestedBytes / 4 && ring_get(ring, &BufferPtr[n]))
+		n++;
+	*BytesRecvdPtr = n * 4;
+	return n == 0 ? XST_NO_DATA : XST_SUCCESS;
+}
+
+void XMbox_ReadBlocking(XMbox *InstancePtr, u32 *BufferPtr, u32 RequestedBytes)
+{
+	mbox_ring *ring = &hw->ring[InstancePtr->Config.RecvID];
+	unsigned long long start = now_ns();
+	u32 n;
+	int spins = 0;
+
+	if (last_read_done != 0)
+		hist_add_ns(&frame_work, start - last_read_done);
+	for (n = 0; n < RequestedBytes / 4; n++)
+	{
+		while (!ring_get(ring, &BufferPtr[n]))
+			backoff(&spins);
+	}
+	last_read_done = now_ns();
+	hist_add_ns(&read_wait, last_read_done - start);
+	reads++;
+	words_read += RequestedBytes / 4;
+}
+
+int XMbox_Write(XMbox *InstancePtr, u32 *BufferPtr, u32 RequestedBytes, u32 *BytesSentPtr)
+{
+	mbox_ring *ring = &hw->ring[InstancePtr->Config.SendID];
+	u32 n = 0;
+
+	while (n < RequestedBytes / 4 && ring_put(ring, BufferPtr[n]))
+		n++;
+	*BytesSentPtr = n * 4;
+	return n == 0 ? XST_FAILURE : XST_SUCCESS;
+}
+
+void XMbox_WriteBlocking(XMbox *InstancePtr, u32 *BufferPtr, u32 RequestedBytes)
+{
+	mbox_ring *ring = &hw->ring[InstancePtr->Config.SendID];
+	unsigned long long start = now_ns();
+	u32 n;
+	int spins = 0;
+
+	for (n = 0; n < RequestedBytes / 4; n++)
+	{
+		while (!ring_put(ring, BufferPtr[n]))
+			backoff(&spins);
+	}
+	hist_add_ns(&write_wait, now_ns() - start);
+	writes++;
+	words_written += RequestedBytes / 4;
+}
+
+u32 XMbox_IsEmpty(XMbox *InstancePtr)
+{
+	mbox_ring *ring = &hw->ring[InstancePtr->Config.RecvID];
+
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail;
+}
+
+u32 XMbox_IsFull(XMbox *InstancePtr)
+{
+	mbox_ring *ring = &hw->ring[InstancePtr->Config.SendID];
+
+	return ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == hw->depth;
+}
+
+//
+//	Mutex
+//
+
+XMutex_Config *XMutex_LookupConfig(u16 DeviceId)
+{
+	mutex_config.DeviceId = DeviceId;
+	mutex_config.NumMutex = XMUTEX_NUM_LOCKS;
+	mutex_config.UserReg = 1;
+	return &mutex_config;
+}
+
+int XMutex_CfgInitialize(XMutex *InstancePtr, XMutex_Config *ConfigPtr, UINTPTR EffectiveAddress)
+{
+	InstancePtr->Config = *ConfigPtr;
+	InstancePtr->Config.BaseAddress = EffectiveAddress;
+	if (shared_hw_init() != XST_SUCCESS)
+		return XST_FAILURE;
+	InstancePtr->IsReady = XIL_COMPONENT_IS_READY;
+	return XST_SUCCESS;
+}
+
+int XMutex_Trylock(XMutex *InstancePtr, u8 MutexNumber)
+{
+	u32 free = 0;
+	u32 me = XPAR_CPU_ID + 1;
+
+	(void) InstancePtr;
+	if (__atomic_compare_exchange_n(&hw->mutex_owner[MutexNumber], &free, me, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return XST_SUCCESS;
+	return free == me ? XST_SUCCESS : XST_FAILURE;	// the hardware lets the owning cpu relock
+}
+
+void XMutex_Lock(XMutex *InstancePtr, u8 MutexNumber)
+{
+	int spins = 0;
+
+	while (XMutex_Trylock(InstancePtr, MutexNumber) != XST_SUCCESS)
+		backoff(&spins);
+}
+
+int XMutex_Unlock(XMutex *InstancePtr, u8 MutexNumber)
+{
+	(void) InstancePtr;
+	__atomic_store_n(&hw->mutex_owner[MutexNumber], 0, __ATOMIC_RELEASE);
+	return XST_SUCCESS;
+}
+
+int XMutex_IsLocked(XMutex *InstancePtr, u8 MutexNumber)
+{
+	(void) InstancePtr;
+	return __atomic_load_n(&hw->mutex_owner[MutexNumber], __ATOMIC_ACQUIRE) != 0;
+}
+
+int XMutex_GetUser(XMutex *InstancePtr, u8 MutexNumber, u32 *User)
+{
+	(void) InstancePtr;
+	*User = __atomic_load_n(&hw->mutex_user[MutexNumber], __ATOMIC_ACQUIRE);
+	return XST_SUCCESS;
+}
+
+int XMutex_SetUser(XMutex *InstancePtr, u8 MutexNumber, u32 User)
+{
+	(void) InstancePtr;
+	__atomic_store_n(&hw->mutex_user[MutexNumber], User, __ATOMIC_RELEASE);
+	return XST_SUCCESS;
+}
@@ -0,0 +1,388 @@
+/*
+ * Host stand-in for the XTft driver. The frame memory the game draws into
+ * is a private mapping placed at the board's DDR addresses
+ * (HOST_DDR_BASE, HOST_DDR_SIZE) so TFT_FRAME_ADDR can be used unchanged.
+ *
+ * XTft_Write draws the 8x12 character cells from xtft_charcode.c, the
+ * foreground colour where the glyph has a pixel and the background colour
+ * elsewhere.
+ *
+ * Once the game polls XTft_GetVsyncStatus a scanout thread runs at
+ * HOST_VSYNC_HZ. An address written to the AR register is only latched at
+ * the next vsync, until then the status bit reads clear, as on the board.
+ * At every vsync the frame on screen is hashed: if it changed since the
+ * previous vsync without a flip, it was drawn into while being scanned out
+ * and the frame is counted as torn.
+ *
+ * BB_TFT_DUMP is a comma separated list of ticks, for example "300,600".
+ * At the first vsync at or after each the frame on screen is written to
+ * frame_<tick>.ppm in BB_TFT_DUMP_DIR, the current directory if unset. A
+ * dump script starts the scanout thread at XTft_CfgInitialize rather than
+ * at the first poll, so frames are dumped without double buffering too.
+ * XTft_HostDumpPPM writes any frame in the DDR window the same way.
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "xmk.h"
+#include "xparameters.h"
+#include "xtft.h"
+#include "xtft_charcode.h"
+#include "sys/timer.h"
+
+#define HOST_DDR_BASE 0x10000000
+#define HOST_DDR_SIZE 0x01000000
+#define HOST_VSYNC_HZ 60
+#define MAX_DUMPS 64
+
+static XTft_Config tft_config;
+static UINTPTR displayed_frame;
+
+static pthread_mutex_t scanout_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t scanout_thread;
+static int scanout_running;
+static UINTPTR latched_frame;		// written to AR, shown from the next vsync
+static int vaddr_latched = 1;
+static unsigned int vsyncs;
+static unsigned int flips;
+static unsigned int torn;
+
+static unsigned int dump_tick[MAX_DUMPS];	// BB_TFT_DUMP, in order
+static int dump_count;
+static int dump_next;
+static unsigned int dumped;
+
+__attribute__((constructor)) static void host_ddr_map()
+{
+	void *ddr = mmap((void *) HOST_DDR_BASE, HOST_DDR_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+	if (ddr != (void *) HOST_DDR_BASE)
+	{
+		fprintf(stderr, "host: cannot map DDR window at 0x%x\n", HOST_DDR_BASE);
+		exit(1);
+	}
+}
+
+static int frame_in_ddr(UINTPTR addr)
+{
+	return addr >= HOST_DDR_BASE && addr + XTFT_DISPLAY_BUFFER_WIDTH * XTFT_DISPLAY_HEIGHT * 4 <= HOST_DDR_BASE + HOST_DDR_SIZE;
+}
+
+static inline u32 *pixel_addr(XTft *InstancePtr, u32 ColVal, u32 RowVal)
+{
+	return (u32 *) (InstancePtr->TftConfig.VideoMemBaseAddr + 4 * (RowVal * XTFT_DISPLAY_BUFFER_WIDTH + ColVal));
+}
+
+static unsigned long long frame_hash(UINTPTR frame)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	u32 *row = (u32 *) frame;
+	int x, y;
+
+	for (y = 0; y < XTFT_DISPLAY_HEIGHT; y++)
+	{
+		for (x = 0; x < XTFT_DISPLAY_WIDTH; x++)
+			hash = (hash ^ row[x]) * 1099511628211ULL;
+		row += XTFT_DISPLAY_BUFFER_WIDTH;
+	}
+	return hash;
+}
+
+static void dump_frame(UINTPTR frame, unsigned int tick)
+{
+	char path[256];
+	char *dir = getenv("BB_TFT_DUMP_DIR");
+
+	snprintf(path, sizeof(path), "%s/frame_%u.ppm", dir != NULL ? dir : ".", tick);
+	if (XTft_HostDumpPPM(frame, path) == 0)
+		dumped++;
+	else
+		fprintf(stderr, "host: cannot write %s\n", path);
+}
+
+static void *scanout_run(void *arg)
+{
+	struct timespec next;
+	UINTPTR frame, last_frame = 0;
+	unsigned long long hash, last_hash = 0;
+
+	(void) arg;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (1)
+	{
+		next.tv_nsec += 1000000000L / HOST_VSYNC_HZ;
+		if (next.tv_nsec >= 1000000000L)
+		{
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		pthread_mutex_lock(&scanout_mutex);
+		vsyncs++;
+		if (!vaddr_latched)
+		{
+			if (latched_frame != displayed_frame)
+				flips++;
+			displayed_frame = latched_frame;
+			vaddr_latched = 1;
+		}
+		frame = displayed_frame;
+		pthread_mutex_unlock(&scanout_mutex);
+
+		while (dump_next < dump_count && xget_clock_ticks() >= dump_tick[dump_next])
+		{
+			dump_frame(frame, dump_tick[dump_next]);
+			dump_next++;
+		}
+
+		hash = frame_hash(frame);
+		if (frame == last_frame && hash != last_hash)
+			torn++;
+		last_frame = frame;
+		last_hash = hash;
+	}
+	return NULL;
+}
+
+static void scanout_report(double seconds)
+{
+	printf("-- host tft report, %.1f s --\n", seconds);
+	printf("  vsyncs %u, flips %u, torn frames %u\n", vsyncs, flips, torn);
+	if (dump_count != 0)
+		printf("  frames dumped %u of %d\n", dumped, dump_count);
+}
+
+// caller holds scanout_mutex
+static void scanout_start()
+{
+	if (scanout_running)
+		return;
+	scanout_running = 1;
+	pthread_create(&scanout_thread, NULL, scanout_run, NULL);
+	xmk_add_report(scanout_report);
+}
+
+static void dump_script()
+{
+	char *env = getenv("BB_TFT_DUMP");
+	char *entry;
+
+	if (env == NULL || dump_count != 0)
+		return;
+	for (entry = env; *entry != '\0' && dump_count < MAX_DUMPS; )
+	{
+		dump_tick[dump_count++] = (unsigned int) strtoul(entry, &entry, 10);
+		if (*entry != ',')
+			break;
+		entry++;
+	}
+	if (dump_count != 0)
+	{
+		pthread_mutex_lock(&scanout_mutex);
+		scanout_start();
+		pthread_mutex_unlock(&scanout_mutex);
+	}
+}
+
+XTft_Config *XTft_LookupConfig(u16 DeviceId)
+{
+	tft_config.DeviceId = DeviceId;
+	tft_config.BaseAddress = XPAR_TFT_0_BASEADDR;
+	tft_config.VideoMemBaseAddr = HOST_DDR_BASE;
+	tft_config.AddrWidth = 32;
+	return &tft_config;
+}
+
+int XTft_CfgInitialize(XTft *InstancePtr, XTft_Config *ConfigPtr, UINTPTR EffectiveAddr)
+{
+	InstancePtr->TftConfig = *ConfigPtr;
+	InstancePtr->TftConfig.BaseAddress = EffectiveAddr;
+	InstancePtr->IsReady = XIL_COMPONENT_IS_READY;
+	InstancePtr->ColVal = 0;
+	InstancePtr->RowVal = 0;
+	InstancePtr->FgColor = 0x00ffffff;
+	InstancePtr->BgColor = 0;
+	displayed_frame = ConfigPtr->VideoMemBaseAddr;
+	XTft_ClearScreen(InstancePtr);
+	dump_script();
+	return XST_SUCCESS;
+}
+
+void XTft_SetPos(XTft *InstancePtr, u32 ColVal, u32 RowVal)
+{
+	InstancePtr->ColVal = ColVal;
+	InstancePtr->RowVal = RowVal;
+}
+
+void XTft_SetPosChar(XTft *InstancePtr, u32 ColVal, u32 RowVal)
+{
+	if (ColVal > XTFT_DISPLAY_WIDTH - XTFT_CHAR_WIDTH)
+		ColVal = 0;
+	if (RowVal > XTFT_DISPLAY_HEIGHT - XTFT_CHAR_HEIGHT)
+		RowVal = 0;
+	XTft_SetPos(InstancePtr, ColVal, RowVal);
+}
+
+void XTft_SetColor(XTft *InstancePtr, u32 FgColor, u32 BgColor)
+{
+	InstancePtr->FgColor = FgColor;
+	InstancePtr->BgColor = BgColor;
+}
+
+void XTft_SetPixel(XTft *InstancePtr, u32 ColVal, u32 RowVal, u32 PixelVal)
+{
+	if (ColVal < XTFT_DISPLAY_WIDTH && RowVal < XTFT_DISPLAY_HEIGHT)
+		*pixel_addr(InstancePtr, ColVal, RowVal) = PixelVal;
+}
+
+void XTft_GetPixel(XTft *InstancePtr, u32 ColVal, u32 RowVal, u32 *PixelVal)
+{
+	*PixelVal = *pixel_addr(InstancePtr, ColVal, RowVal);
+}
+
+void XTft_FillScreen(XTft *InstancePtr, u32 ColStartVal, u32 RowStartVal, u32 ColEndVal, u32 RowEndVal, u32 PixelVal)
+{
+	u32 x, y;
+
+	for (y = RowStartVal; y <= RowEndVal && y < XTFT_DISPLAY_HEIGHT; y++)
+	{
+		for (x = ColStartVal; x <= ColEndVal && x < XTFT_DISPLAY_WIDTH; x++)
+			*pixel_addr(InstancePtr, x, y) = PixelVal;
+	}
+}
+
+void XTft_ClearScreen(XTft *InstancePtr)
+{
+	XTft_FillScreen(InstancePtr, 0, 0, XTFT_DISPLAY_WIDTH - 1, XTFT_DISPLAY_HEIGHT - 1, InstancePtr->BgColor);
+	XTft_SetPos(InstancePtr, 0, 0);
+}
+
+void XTft_Write(XTft *InstancePtr, u8 CharValue)
+{
+	const u8 *glyph;
+	u32 x, y;
+
+	if (CharValue == '\n' || InstancePtr->ColVal > XTFT_DISPLAY_WIDTH - XTFT_CHAR_WIDTH)
+	{
+		InstancePtr->ColVal = 0;
+		InstancePtr->RowVal += XTFT_CHAR_HEIGHT;
+		if (InstancePtr->RowVal > XTFT_DISPLAY_HEIGHT - XTFT_CHAR_HEIGHT)
+			InstancePtr->RowVal = 0;
+		if (CharValue == '\n')
+			return;
+	}
+	if (CharValue == '\r')
+	{
+		InstancePtr->ColVal = 0;
+		return;
+	}
+	if (CharValue < XTFT_ASCIICHAR_OFFSET || CharValue >= XTFT_ASCIICHAR_OFFSET + XTFT_ASCIICHAR_COUNT)
+		CharValue = ' ';
+	glyph = XTft_VidChars[CharValue - XTFT_ASCIICHAR_OFFSET];
+	for (y = 0; y < XTFT_CHAR_HEIGHT; y++)
+	{
+		for (x = 0; x < XTFT_CHAR_WIDTH; x++)
+		{
+			*pixel_addr(InstancePtr, InstancePtr->ColVal + x, InstancePtr->RowVal + y) =
+				(glyph[y] & (0x80 >> x)) ? InstancePtr->FgColor : InstancePtr->BgColor;
+		}
+	}
+	InstancePtr->ColVal += XTFT_CHAR_WIDTH;
+}
+
+void XTft_SetFrameBaseAddr(XTft *InstancePtr, UINTPTR NewFrameBaseAddr)
+{
+	InstancePtr->TftConfig.VideoMemBaseAddr = NewFrameBaseAddr;
+	XTft_WriteReg(InstancePtr->TftConfig.BaseAddress, XTFT_AR_OFFSET, NewFrameBaseAddr);
+}
+
+u32 XTft_GetVsyncStatus(XTft *InstancePtr)
+{
+	int latched;
+
+	(void) InstancePtr;
+	pthread_mutex_lock(&scanout_mutex);
+	scanout_start();
+	latched = vaddr_latched;
+	pthread_mutex_unlock(&scanout_mutex);
+	return latched ? XTFT_IESR_VADDRLATCH_STATUS_MASK : 0;
+}
+
+void XTft_EnableDisplay(XTft *InstancePtr)
+{
+	(void) InstancePtr;
+}
+
+void XTft_DisableDisplay(XTft *InstancePtr)
+{
+	(void) InstancePtr;
+}
+
+void XTft_WriteReg(UINTPTR BaseAddress, u32 RegOffset, u32 Data)
+{
+	(void) BaseAddress;
+	if (RegOffset != XTFT_AR_OFFSET || !frame_in_ddr(Data))
+		return;
+
+	// without the scanout thread there is no vsync, the address is taken at once
+	pthread_mutex_lock(&scanout_mutex);
+	if (scanout_running)
+	{
+		latched_frame = Data;
+		vaddr_latched = 0;
+	}
+	else
+		displayed_frame = Data;
+	pthread_mutex_unlock(&scanout_mutex);
+}
+
+u32 XTft_ReadReg(UINTPTR BaseAddress, u32 RegOffset)
+{
+	(void) BaseAddress;
+	if (RegOffset == XTFT_AR_OFFSET)
+		return (u32) displayed_frame;
+	if (RegOffset == XTFT_IESR_OFFSET)
+		return XTft_GetVsyncStatus(NULL);
+	return 0;
+}
+
+UINTPTR XTft_HostDisplayedFrame()
+{
+	UINTPTR frame;
+
+	pthread_mutex_lock(&scanout_mutex);
+	frame = displayed_frame;
+	pthread_mutex_unlock(&scanout_mutex);
+	return frame;
+}
+
+// binary PPM, XTFT_DISPLAY_WIDTH by XTFT_DISPLAY_HEIGHT, red in bits 16-23 of a pixel as on the TFT
+int XTft_HostDumpPPM(UINTPTR frame, const char *path)
+{
+	unsigned char line[XTFT_DISPLAY_WIDTH * 3];
+	u32 *row = (u32 *) frame;
+	FILE *file;
+	int x, y;
+
+	if (!frame_in_ddr(frame) || (file = fopen(path, "wb")) == NULL)
+		return -1;
+	fprintf(file, "P6\n%d %d\n255\n", XTFT_DISPLAY_WIDTH, XTFT_DISPLAY_HEIGHT);
+	for (y = 0; y < XTFT_DISPLAY_HEIGHT; y++)
+	{
+		for (x = 0; x < XTFT_DISPLAY_WIDTH; x++)
+		{
+			line[3 * x] = (row[x] >> 16) & 0xff;
+			line[3 * x + 1] = (row[x] >> 8) & 0xff;
+			line[3 * x + 2] = row[x] & 0xff;
+		}
+		fwrite(line, 1, sizeof(line), file);
+		row += XTFT_DISPLAY_BUFFER_WIDTH;
+	}
+	return fclose(file) == 0 ? 0 : -1;
+}
@@ -0,0 +1,68 @@
+/*
+ * Host stand-in for polled uart input, see include/xuartps.h
+ */
+#define _GNU_SOURCE
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xuartps.h"
+#include "sys/timer.h"
+
+#define MAX_SCRIPT 64
+
+static struct {
+	unsigned int tick;
+	u8 key;
+} script[MAX_SCRIPT];
+static int script_length = -1;
+static int script_next;
+static int stdin_closed;
+
+static void script_load()
+{
+	char *env = getenv("BB_UART");
+	char *entry = env;
+
+	script_length = 0;
+	while (entry != NULL && *entry != '\0' && script_length < MAX_SCRIPT)
+	{
+		char *key = strchr(entry, '=');
+
+		if (key == NULL || key[1] == '\0')
+			break;
+		script[script_length].tick = (unsigned int) strtoul(entry, NULL, 10);
+		script[script_length].key = key[1];
+		script_length++;
+		entry = strchr(key, ',');
+		if (entry != NULL)
+			entry++;
+	}
+}
+
+u32 XUartPs_IsReceiveData(UINTPTR BaseAddress)
+{
+	struct pollfd fd = { 0, POLLIN, 0 };
+
+	(void) BaseAddress;
+	if (script_length < 0)
+		script_load();
+	if (script_next < script_length && xget_clock_ticks() >= script[script_next].tick)
+		return 1;
+	if (stdin_closed || !isatty(0))
+		return 0;
+	return poll(&fd, 1, 0) == 1 && (fd.revents & POLLIN);
+}
+
+u8 XUartPs_RecvByte(UINTPTR BaseAddress)
+{
+	u8 key = 0;
+
+	(void) BaseAddress;
+	if (script_next < script_length && xget_clock_ticks() >= script[script_next].tick)
+		return script[script_next++].key;
+	if (read(0, &key, 1) != 1)
+		stdin_closed = 1;
+	return key;
+}